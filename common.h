@@ -32,6 +32,7 @@
 #include <PRM/PRM_Include.h>
 #include <PRM/PRM_TemplateBuilder.h>
 #include <PRM/PRM_SpareData.h>
+#include <PRM/PRM_Conditional.h>
 
 #include <OP/OP_Operator.h>
 #include <OP/OP_AutoLockInputs.h>
@@ -39,6 +40,8 @@
 #include <SOP/SOP_NodeVerb.h>
 
 #include <GU/GU_Detail.h>
+#include <GA/GA_SplittableRange.h>
+#include <GA/GA_Iterator.h>
 #include <GEO/GEO_PrimVolume.h>
 #include <GU/GU_PrimVolume.h>
 #include <GU/GU_PrimPoly.h>
@@ -56,6 +59,15 @@
 
 #include <SYS/SYS_Math.h>
 
+#include <UT/UT_Lock.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <tuple>
+
 #include <PY/PY_Python.h>
 
 
@@ -244,6 +256,288 @@ namespace HinaFlow
         return {l, u};
     }
 
+    /**
+    * Adds the wall time between construction and destruction to *SECONDS, does nothing when SECONDS is null.
+    */
+    struct ScopedTimer
+    {
+        explicit ScopedTimer(double* seconds) : seconds(seconds), start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer()
+        {
+            if (seconds)
+                *seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    private:
+        double* seconds;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    /**
+    * State a solver node keeps for an object between steps, keyed by engine, creating node and object.
+    * Entries of objects that are gone from their engine are dropped on the next lookup in that engine.
+    * Only the lookup is locked, each entry is used by its own node and object alone.
+    */
+    template <typename T>
+    class SolverStates
+    {
+    public:
+        T& Acquire(const SIM_Engine& engine, const SIM_Data& node, const SIM_Object& obj)
+        {
+            UT_AutoLock lock(LOCK);
+            for (auto it = STATES.begin(); it != STATES.end();)
+            {
+                if (std::get<0>(it->first) == &engine && !engine.getSimulationObjectFromId(std::get<2>(it->first)))
+                    it = STATES.erase(it);
+                else
+                    ++it;
+            }
+            std::unique_ptr<T>& state = STATES[{&engine, node.getCreatorId(), obj.getObjectId()}];
+            if (!state)
+                state = std::make_unique<T>();
+            return *state;
+        }
+
+    private:
+        UT_Lock LOCK;
+        std::map<std::tuple<const SIM_Engine*, int, int>, std::unique_ptr<T>> STATES;
+    };
+
+    inline std::uint64_t HASH_COMBINE(const std::uint64_t seed, const std::uint64_t value) { return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)); }
+
+    inline std::uint64_t HASH_COMBINE(const std::uint64_t seed, const float value)
+    {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return HASH_COMBINE(seed, static_cast<std::uint64_t>(bits));
+    }
+
+    /**
+    * Content hash of an index field (resolution and values), one z slice per task.
+    */
+    inline std::uint64_t HASH_FIELD(const SIM_RawIndexField* FIELD)
+    {
+        const UT_Vector3I res = FIELD->getVoxelRes();
+        std::uint64_t seed = 0;
+        for (int AXIS : {0, 1, 2})
+            seed = HASH_COMBINE(seed, static_cast<std::uint64_t>(res[AXIS]));
+
+        exint value = 0;
+        if (FIELD->field()->isConstant(&value))
+            return HASH_COMBINE(seed, static_cast<std::uint64_t>(value));
+
+        std::vector<std::uint64_t> slices(res.z());
+        UTparallelFor(UT_BlockedRange<exint>(0, res.z()), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint z = r.begin(); z < r.end(); ++z)
+            {
+                std::uint64_t slice = 0;
+                for (exint y = 0; y < res.y(); ++y)
+                    for (exint x = 0; x < res.x(); ++x)
+                        slice = HASH_COMBINE(slice, static_cast<std::uint64_t>(FIELD->field()->getValue(static_cast<int>(x), static_cast<int>(y), static_cast<int>(z))));
+                slices[z] = slice;
+            }
+        });
+        for (const std::uint64_t slice : slices)
+            seed = HASH_COMBINE(seed, slice);
+        return seed;
+    }
+
+    /**
+    * Temporal blocking for explicit stencil steps on flat buffers (x fastest).
+    * The (y, z) plane is cut into tiles, each tile is copied with HALO extra cells into local buffers,
+    * ADVANCE runs several steps on the local copy, and only the tile interior is written to OUT.
+    * Tile borders behave as walls inside ADVANCE, which only corrupts the halo as long as HALO covers
+    * the stencil reach of all the steps taken, so OUT matches the untiled sweeps exactly.
+    * ADVANCE also receives the global index of the local origin, for position dependent coefficients.
+    * IN and OUT must not alias.
+    */
+    template <size_t N, typename Advance>
+    void TEMPORAL_BLOCKING(const std::array<const std::vector<float>*, N>& IN, const std::array<std::vector<float>*, N>& OUT, const std::vector<unsigned char>& mask, const UT_Vector3I& res, const exint halo, Advance advance)
+    {
+        const exint nx = res.x(), ny = res.y(), nz = res.z();
+        const exint tile = std::max<exint>(16, 4 * halo); // keeps the redundant halo work below ~2.25x
+        const exint tiles_y = (ny + tile - 1) / tile, tiles_z = (nz + tile - 1) / tile;
+
+        UTparallelFor(UT_BlockedRange<exint>(0, tiles_y * tiles_z), [&](const UT_BlockedRange<exint>& r)
+        {
+            std::array<std::vector<float>, N> local;
+            std::vector<unsigned char> local_mask;
+            for (exint t = r.begin(); t < r.end(); ++t)
+            {
+                const exint y0 = (t % tiles_y) * tile, y1 = std::min(y0 + tile, ny);
+                const exint z0 = (t / tiles_y) * tile, z1 = std::min(z0 + tile, nz);
+                const exint ey0 = std::max<exint>(y0 - halo, 0), ey1 = std::min(y1 + halo, ny);
+                const exint ez0 = std::max<exint>(z0 - halo, 0), ez1 = std::min(z1 + halo, nz);
+                const UT_Vector3I local_res(nx, ey1 - ey0, ez1 - ez0);
+                const exint local_size = nx * local_res.y() * local_res.z();
+
+                local_mask.resize(local_size);
+                for (auto& buffer : local)
+                    buffer.resize(local_size);
+                for (exint z = ez0; z < ez1; ++z)
+                    for (exint y = ey0; y < ey1; ++y)
+                    {
+                        const exint src = nx * (y + ny * z), dst = nx * ((y - ey0) + local_res.y() * (z - ez0));
+                        std::copy_n(mask.begin() + src, nx, local_mask.begin() + dst);
+                        for (size_t k = 0; k < N; ++k)
+                            std::copy_n(IN[k]->begin() + src, nx, local[k].begin() + dst);
+                    }
+
+                advance(local, local_mask, local_res, UT_Vector3I(0, ey0, ez0));
+
+                for (exint z = z0; z < z1; ++z)
+                    for (exint y = y0; y < y1; ++y)
+                    {
+                        const exint dst = nx * (y + ny * z), src = nx * ((y - ey0) + local_res.y() * (z - ez0));
+                        for (size_t k = 0; k < N; ++k)
+                            std::copy_n(local[k].begin() + src, nx, OUT[k]->begin() + dst);
+                    }
+            }
+        });
+    }
+
+    /**
+    * Exclusive prefix sum of VALUES in place, chunks are summed in parallel and then offset in parallel.
+    * Returns the total.
+    */
+    inline exint PREFIX_SUM(std::vector<exint>& values)
+    {
+        constexpr exint CHUNK = 1 << 16;
+        const exint size = static_cast<exint>(values.size());
+        const exint chunks = (size + CHUNK - 1) / CHUNK;
+        std::vector<exint> offset(chunks + 1, 0);
+        UTparallelFor(UT_BlockedRange<exint>(0, chunks), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint c = r.begin(); c < r.end(); ++c)
+            {
+                exint sum = 0;
+                for (exint i = c * CHUNK; i < std::min(size, (c + 1) * CHUNK); ++i)
+                    sum += values[i];
+                offset[c + 1] = sum;
+            }
+        });
+        for (exint c = 0; c < chunks; ++c)
+            offset[c + 1] += offset[c];
+        UTparallelFor(UT_BlockedRange<exint>(0, chunks), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint c = r.begin(); c < r.end(); ++c)
+            {
+                exint sum = offset[c];
+                for (exint i = c * CHUNK; i < std::min(size, (c + 1) * CHUNK); ++i)
+                {
+                    const exint value = values[i];
+                    values[i] = sum;
+                    sum += value;
+                }
+            }
+        });
+        return offset[chunks];
+    }
+
+    /**
+    * Stable counting sort of the element indices by KEY in [0, KEYS), elements with a negative key are dropped.
+    * Elements of key k end up in ORDER[START[k], START[k + 1]), in index order.
+    * Two levels without atomics: per element block counts of each key range with a prefix over (range, block)
+    * scatter the elements into range buckets, then every range is counting sorted on its own, all in parallel.
+    */
+    inline void COUNTING_SORT(const std::vector<exint>& key, const exint keys, std::vector<exint>& start, std::vector<exint>& order)
+    {
+        constexpr exint BLOCK = 1 << 16, RANGE = 1 << 12;
+        const exint size = static_cast<exint>(key.size());
+        const exint blocks = std::max<exint>((size + BLOCK - 1) / BLOCK, 1);
+        const exint ranges = std::max<exint>((keys + RANGE - 1) / RANGE, 1);
+
+        // Range Buckets, counts are laid out range major so that one prefix gives every (range, block) cursor
+        std::vector<exint> cursor(ranges * blocks + 1, 0);
+        UTparallelFor(UT_BlockedRange<exint>(0, blocks), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint b = r.begin(); b < r.end(); ++b)
+                for (exint i = b * BLOCK; i < std::min(size, (b + 1) * BLOCK); ++i)
+                    if (key[i] >= 0)
+                        ++cursor[key[i] / RANGE * blocks + b];
+        });
+        const exint total = PREFIX_SUM(cursor);
+        std::vector<exint> range_start(ranges + 1);
+        for (exint g = 0; g < ranges; ++g)
+            range_start[g] = cursor[g * blocks];
+        range_start[ranges] = total;
+        std::vector<exint> bucket(total);
+        UTparallelFor(UT_BlockedRange<exint>(0, blocks), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint b = r.begin(); b < r.end(); ++b)
+                for (exint i = b * BLOCK; i < std::min(size, (b + 1) * BLOCK); ++i)
+                    if (key[i] >= 0)
+                        bucket[cursor[key[i] / RANGE * blocks + b]++] = i;
+        });
+
+        // Per Range Counting Sort, each range owns its slice of START and ORDER
+        start.assign(keys + 1, 0);
+        order.resize(total);
+        UTparallelFor(UT_BlockedRange<exint>(0, ranges), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint g = r.begin(); g < r.end(); ++g)
+            {
+                const exint k0 = g * RANGE, k1 = std::min(keys, k0 + RANGE);
+                for (exint p = range_start[g]; p < range_start[g + 1]; ++p)
+                    ++start[key[bucket[p]]];
+                exint offset = range_start[g];
+                for (exint k = k0; k < k1; ++k)
+                {
+                    const exint count = start[k];
+                    start[k] = offset;
+                    offset += count;
+                }
+                std::vector<exint> local(start.begin() + k0, start.begin() + k1);
+                for (exint p = range_start[g]; p < range_start[g + 1]; ++p)
+                    order[local[key[bucket[p]] - k0]++] = bucket[p];
+            }
+        });
+        start[keys] = total;
+    }
+
+    /**
+    * Z-order key of an integer cell, 17 bits per axis so that the key is exact in a double.
+    */
+    inline std::uint64_t MORTON(const UT_Vector3I& cell)
+    {
+        auto spread = [](const exint c)
+        {
+            auto v = static_cast<std::uint64_t>(std::clamp<exint>(c, 0, 0x1ffff));
+            v = (v | v << 32) & 0x1f00000000ffffull;
+            v = (v | v << 16) & 0x1f0000ff0000ffull;
+            v = (v | v << 8) & 0x100f00f00f00f00full;
+            v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+            v = (v | v << 2) & 0x1249249249249249ull;
+            return v;
+        };
+        constexpr exint BIAS = 1 << 16; // cells outside [-2^16, 2^16) are clamped to the border
+        return spread(cell.x() + BIAS) | spread(cell.y() + BIAS) << 1 | spread(cell.z() + BIAS) << 2;
+    }
+
+    /**
+    * Reorder the points of GDP along the Z-order curve of cells of size H, so that points close in space
+    * are close in memory. All point attributes follow, and offsets are compacted to match the new index order.
+    */
+    inline void MORTON_SORT_POINTS(GU_Detail& gdp, const float h)
+    {
+        const exint size = gdp.getNumPoints();
+        std::vector<fpreal> keys(size);
+        UTparallelFor(UT_BlockedRange<exint>(0, size), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint i = r.begin(); i < r.end(); ++i)
+            {
+                const UT_Vector3 pos = gdp.getPos3(gdp.pointOffset(i)) / h;
+                const UT_Vector3I cell(static_cast<exint>(SYSfloor(pos.x())), static_cast<exint>(SYSfloor(pos.y())), static_cast<exint>(SYSfloor(pos.z())));
+                keys[i] = static_cast<fpreal>(MORTON(cell));
+            }
+        });
+        gdp.sortPointList(keys.data());
+        gdp.defragment();
+    }
+
     inline static std::function Poly6 = [](const UT_Vector3& r, const float h) -> float
     {
         if (const float r_length = r.length(); r_length <= h)
@@ -15,6 +15,32 @@
 #include "common.h"
 #include "src/diffusion.h"
 
+/**
+* Cached operators per node and object, so a steady frame skips the matrix assembly.
+*/
+namespace
+{
+    HinaFlow::SolverStates<HinaFlow::Diffusion::OperatorCache> OPERATOR_CACHES;
+
+    /**
+    * A raw field can share the marker's operator if it is sampled at the cell centers or on the faces of one axis of the same grid.
+    */
+    bool MATCHES_MARKER(const SIM_RawField* FIELD, const SIM_IndexField* MARKER)
+    {
+        const UT_Vector3I res = FIELD->getVoxelRes();
+        const UT_Vector3I marker_res = MARKER->getField()->getVoxelRes();
+        int face_axes = 0;
+        for (int AXIS : {0, 1, 2})
+        {
+            const exint diff = res[AXIS] - marker_res[AXIS];
+            if (diff != 0 && diff != 1)
+                return false;
+            face_axes += static_cast<int>(diff);
+        }
+        return face_axes <= 1;
+    }
+}
+
 const SIM_DopDescription* GAS_SolveDiffusion::getDopDescription()
 {
     static std::vector<PRM_Template> PRMs;
@@ -22,6 +48,18 @@ const SIM_DopDescription* GAS_SolveDiffusion::getDopDescription()
     ACTIVATE_GAS_DENSITY
     ACTIVATE_GAS_STENCIL
     ACTIVATE_GAS_COLOR
+    ACTIVATE_GAS_FIELD
+
+    static std::array<PRM_Name, 4> SolverType = {
+        PRM_Name("0", "PCG"),
+        PRM_Name("1", "ADI"),
+        PRM_Name("2", "RKC"),
+        PRM_Name(nullptr),
+    };
+    static PRM_Name SolverTypeName("SolverType", "Solver Type");
+    static PRM_Default SolverTypeNameDefault(0);
+    static PRM_ChoiceList CLSolverType(PRM_CHOICELIST_SINGLE, SolverType.data());
+    PRMs.emplace_back(PRM_ORD, 1, &SolverTypeName, &SolverTypeNameDefault, &CLSolverType);
 
     static std::array<PRM_Name, 5> PCG_METHOD = {
         PRM_Name("0", "PCG_NONE"),
@@ -31,12 +69,17 @@ const SIM_DopDescription* GAS_SolveDiffusion::getDopDescription()
         PRM_Name(nullptr),
     };
     static PRM_Name PCG_METHODName("PCG_METHOD", "PCG METHOD");
-    static PRM_Default PCG_METHODNameDefault(3);
+    static PRM_Default PCG_METHODNameDefault(1);
     static PRM_ChoiceList CLPCG_METHOD(PRM_CHOICELIST_SINGLE, PCG_METHOD.data());
-    PRMs.emplace_back(PRM_ORD, 1, &PCG_METHODName, &PCG_METHODNameDefault, &CLPCG_METHOD);
+    static PRM_Conditional CDPCG_METHOD("{ CacheOperator == 1 }"); // the cached operator carries its own Jacobi preconditioner
+    PRMs.emplace_back(PRM_ORD, 1, &PCG_METHODName, &PCG_METHODNameDefault, &CLPCG_METHOD, nullptr, nullptr, nullptr, 1, nullptr, &CDPCG_METHOD);
     PARAMETER_BOOL(MultiThreaded, false)
+    PARAMETER_BOOL(AutoSpectral, true)
+    PARAMETER_BOOL(CacheOperator, true)
 
     PARAMETER_FLOAT(Diffusion, 0.01)
+    PARAMETER_INT(RKCStages, 8)
+    PARAMETER_INT(TemporalBlock, 0)
     PRMs.emplace_back();
 
     static SIM_DopDescription DESC(GEN_NODE,
@@ -71,10 +114,48 @@ bool GAS_SolveDiffusion::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, S
     /**
     * For smoke applications, we assume "air" is the same as "smoke",
     * ie. all cells are filled with "smoke", the only difference is the density value.
+    * The domain is then an open box, where AutoSpectral replaces the PCG solve by the exact DCT solve.
     */
     HinaFlow::FILL_FIELD(MARKER, static_cast<exint>(HinaFlow::CellType::Fluid));
 
+    /**
+    * Additional scalar and vector fields matched by the Field parameter are
+    * diffused with the same operator, instead of one Solve Diffusion node per field.
+    */
+    SIM_DataArray FIELDS;
+    getMatchingData(FIELDS, obj, GAS_NAME_FIELD);
+    std::vector<SIM_ScalarField*> FIELDS_LIST;
+    std::vector<SIM_VectorField*> FIELDV_LIST;
+    bool skipped = false;
+    for (SIM_Data* data : FIELDS)
+    {
+        if (auto* S = SIM_DATA_CAST(data, SIM_ScalarField); S && S != D)
+        {
+            if (HinaFlow::CHECK_THE_SAME_DIMENSION(S, MARKER) && MATCHES_MARKER(S->getField(), MARKER))
+                FIELDS_LIST.push_back(S);
+            else
+                skipped = true;
+        }
+        else if (auto* V = SIM_DATA_CAST(data, SIM_VectorField); V && V != COLOR)
+        {
+            bool matches = HinaFlow::CHECK_THE_SAME_DIMENSION(V, MARKER);
+            for (int AXIS : {0, 1, 2})
+                matches &= MATCHES_MARKER(V->getField(AXIS), MARKER);
+            if (matches)
+                FIELDV_LIST.push_back(V);
+            else
+                skipped = true;
+        }
+    }
+    if (skipped)
+        addError(obj, SIM_MESSAGE, "Fields matched by Field that do not share the Stencil grid were not diffused", UT_ERROR_WARNING);
+
     HinaFlow::Diffusion::Input input{D, COLOR, MARKER};
+    input.dt = static_cast<float>(timestep);
+    if (getCacheOperator())
+        input.CACHE = &OPERATOR_CACHES.Acquire(engine, *this, *obj);
+    input.FIELDS_LIST = FIELDS_LIST;
+    input.FIELDV_LIST = FIELDV_LIST;
     HinaFlow::Diffusion::Param param;
     switch (getPCG_METHOD())
     {
@@ -82,20 +163,40 @@ bool GAS_SolveDiffusion::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, S
         break;
     case 1: param.preconditioner = SIM_RawField::PCG_METHOD::PCG_JACOBI;
         break;
-    case 2: param.preconditioner = SIM_RawField::PCG_METHOD::PCG_CHOLESKY;
-        break;
-    case 3: param.preconditioner = SIM_RawField::PCG_METHOD::PCG_MIC;
+    case 2: // the sparse solvers only take a Jacobi preconditioner
+    case 3: param.preconditioner = SIM_RawField::PCG_METHOD::PCG_JACOBI;
+        if (getSolverType() == 0 && !getCacheOperator())
+            addError(obj, SIM_MESSAGE, "PCG_CHOLESKY and PCG_MIC are not available, PCG_JACOBI is used instead", UT_ERROR_WARNING);
         break;
     default:
         throw std::runtime_error("Invalid PCG_METHOD");
     }
+    if (input.CACHE)
+        param.preconditioner = SIM_RawField::PCG_METHOD::PCG_JACOBI; // PCG_METHOD is disabled while caching
     param.diffusion = static_cast<float>(getDiffusion());
+    param.rkc_stages = static_cast<int>(getRKCStages());
+    param.temporal_block = static_cast<int>(getTemporalBlock());
     HinaFlow::Diffusion::Result result{D, COLOR};
+    result.FIELDS_LIST = FIELDS_LIST;
+    result.FIELDV_LIST = FIELDV_LIST;
 
-    if (getMultiThreaded())
-        HinaFlow::Diffusion::SolveMultiThreaded(input, param, result);
-    else
-        HinaFlow::Diffusion::Solve(input, param, result);
+    switch (getSolverType())
+    {
+    case 0:
+        if (getAutoSpectral())
+            HinaFlow::Diffusion::SolveSpectral(input, param, result);
+        else if (getMultiThreaded() || input.CACHE || !FIELDS_LIST.empty() || !FIELDV_LIST.empty() || param.preconditioner != SIM_RawField::PCG_METHOD::PCG_NONE) // Solve is unpreconditioned
+            HinaFlow::Diffusion::SolveMultiThreaded(input, param, result);
+        else
+            HinaFlow::Diffusion::Solve(input, param, result);
+        break;
+    case 1: HinaFlow::Diffusion::SolveADI(input, param, result);
+        break;
+    case 2: HinaFlow::Diffusion::SolveRKC(input, param, result);
+        break;
+    default:
+        throw std::runtime_error("Invalid SolverType");
+    }
 
     return true;
 }
@@ -24,9 +24,14 @@ public:
     inline static auto DATANAME = "SolveDiffusion";
     static constexpr bool UNIQUE_DATANAME = false;
 
+    GETSET_DATA_FUNCS_I("SolverType", SolverType)
     GETSET_DATA_FUNCS_I("PCG_METHOD", PCG_METHOD)
     GETSET_DATA_FUNCS_B("MultiThreaded", MultiThreaded)
+    GETSET_DATA_FUNCS_B("AutoSpectral", AutoSpectral)
+    GETSET_DATA_FUNCS_B("CacheOperator", CacheOperator)
     GETSET_DATA_FUNCS_F("Diffusion", Diffusion)
+    GETSET_DATA_FUNCS_I("RKCStages", RKCStages)
+    GETSET_DATA_FUNCS_I("TemporalBlock", TemporalBlock)
 
 protected:
     explicit GAS_SolveDiffusion(const SIM_DataFactory* factory): BaseClass(factory) {}
@@ -15,6 +15,22 @@
 #include "common.h"
 #include "src/wave.h"
 
+/**
+* Wave history and cached operator per node and object, so the node only needs the current field
+* and a steady frame skips the matrix assembly. Rewinding the simulation restarts the history at rest.
+*/
+namespace
+{
+    struct WaveState
+    {
+        HinaFlow::Wave::History HISTORY;
+        HinaFlow::Wave::OperatorCache CACHE;
+        SIM_Time time = -1;
+    };
+
+    HinaFlow::SolverStates<WaveState> WAVE_STATES;
+}
+
 const SIM_DopDescription* GAS_SolveWave::getDopDescription()
 {
     static std::vector<PRM_Template> PRMs;
@@ -24,6 +40,16 @@ const SIM_DopDescription* GAS_SolveWave::getDopDescription()
     ACTIVATE_GAS_STENCIL
     ACTIVATE_GAS_COLOR
 
+    static std::array<PRM_Name, 3> SolverType = {
+        PRM_Name("0", "PCG"),
+        PRM_Name("1", "Explicit"),
+        PRM_Name(nullptr),
+    };
+    static PRM_Name SolverTypeName("SolverType", "Solver Type");
+    static PRM_Default SolverTypeNameDefault(0);
+    static PRM_ChoiceList CLSolverType(PRM_CHOICELIST_SINGLE, SolverType.data());
+    PRMs.emplace_back(PRM_ORD, 1, &SolverTypeName, &SolverTypeNameDefault, &CLSolverType);
+
     static std::array<PRM_Name, 5> PCG_METHOD = {
         PRM_Name("0", "PCG_NONE"),
         PRM_Name("1", "PCG_JACOBI"),
@@ -32,12 +58,19 @@ const SIM_DopDescription* GAS_SolveWave::getDopDescription()
         PRM_Name(nullptr),
     };
     static PRM_Name PCG_METHODName("PCG_METHOD", "PCG METHOD");
-    static PRM_Default PCG_METHODNameDefault(3);
+    static PRM_Default PCG_METHODNameDefault(1);
     static PRM_ChoiceList CLPCG_METHOD(PRM_CHOICELIST_SINGLE, PCG_METHOD.data());
-    PRMs.emplace_back(PRM_ORD, 1, &PCG_METHODName, &PCG_METHODNameDefault, &CLPCG_METHOD);
+    static PRM_Conditional CDPCG_METHOD("{ CacheOperator == 1 }"); // the cached operator carries its own Jacobi preconditioner
+    PRMs.emplace_back(PRM_ORD, 1, &PCG_METHODName, &PCG_METHODNameDefault, &CLPCG_METHOD, nullptr, nullptr, nullptr, 1, nullptr, &CDPCG_METHOD);
     PARAMETER_BOOL(MultiThreaded, false)
+    PARAMETER_BOOL(InternalHistory, true)
+    PARAMETER_BOOL(CacheOperator, true)
 
     PARAMETER_FLOAT(Wave, 0.01)
+    PARAMETER_FLOAT(CFL, 0.9)
+    PARAMETER_INT(TemporalBlock, 0)
+    PARAMETER_INT(AbsorbingLayer, 0)
+    PARAMETER_FLOAT(AbsorbingStrength, 10)
     PRMs.emplace_back();
 
     static SIM_DopDescription DESC(GEN_NODE,
@@ -58,13 +91,13 @@ bool GAS_SolveWave::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, SIM_Ti
     SIM_IndexField* MARKER = getIndexField(obj, GAS_NAME_STENCIL);
     SIM_VectorField* COLOR = getVectorField(obj, GAS_NAME_COLOR);
 
-    if (!HinaFlow::CHECK_NOT_NULL(D, T, MARKER, COLOR))
+    if (!HinaFlow::CHECK_NOT_NULL(D, MARKER, COLOR) || (!getInternalHistory() && !T))
     {
         addError(obj, SIM_MESSAGE, "Missing GAS fields", UT_ERROR_FATAL);
         return false;
     }
 
-    if (!HinaFlow::CHECK_THE_SAME_DIMENSION(D, T, MARKER, COLOR))
+    if (!HinaFlow::CHECK_THE_SAME_DIMENSION(D, MARKER, COLOR) || (!getInternalHistory() && !HinaFlow::CHECK_THE_SAME_DIMENSION(D, T)))
     {
         addError(obj, SIM_MESSAGE, "GAS fields have different dimensions", UT_ERROR_FATAL);
         return false;
@@ -77,6 +110,17 @@ bool GAS_SolveWave::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, SIM_Ti
     HinaFlow::FILL_FIELD(MARKER, static_cast<exint>(HinaFlow::CellType::Fluid));
 
     HinaFlow::Wave::Input input{D, T, MARKER};
+    input.dt = static_cast<float>(timestep);
+    WaveState& state = WAVE_STATES.Acquire(engine, *this, *obj);
+    if (getInternalHistory())
+    {
+        if (time <= state.time)
+            state.HISTORY = HinaFlow::Wave::History{};
+        state.time = time;
+        input.HISTORY = &state.HISTORY;
+    }
+    if (getCacheOperator())
+        input.CACHE = &state.CACHE;
     HinaFlow::Wave::Param param;
     switch (getPCG_METHOD())
     {
@@ -84,20 +128,36 @@ bool GAS_SolveWave::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, SIM_Ti
         break;
     case 1: param.preconditioner = SIM_RawField::PCG_METHOD::PCG_JACOBI;
         break;
-    case 2: param.preconditioner = SIM_RawField::PCG_METHOD::PCG_CHOLESKY;
-        break;
-    case 3: param.preconditioner = SIM_RawField::PCG_METHOD::PCG_MIC;
+    case 2: // the sparse solvers only take a Jacobi preconditioner
+    case 3: param.preconditioner = SIM_RawField::PCG_METHOD::PCG_JACOBI;
+        if (getSolverType() == 0 && !getCacheOperator())
+            addError(obj, SIM_MESSAGE, "PCG_CHOLESKY and PCG_MIC are not available, PCG_JACOBI is used instead", UT_ERROR_WARNING);
         break;
     default:
         throw std::runtime_error("Invalid PCG_METHOD");
     }
+    if (input.CACHE)
+        param.preconditioner = SIM_RawField::PCG_METHOD::PCG_JACOBI; // PCG_METHOD is disabled while caching
     param.wave = static_cast<float>(getWave());
+    param.cfl = static_cast<float>(getCFL());
+    param.temporal_block = static_cast<int>(getTemporalBlock());
+    param.absorbing_layer = static_cast<int>(getAbsorbingLayer());
+    param.absorbing_strength = static_cast<float>(getAbsorbingStrength());
     HinaFlow::Wave::Result result{D};
 
-    if (getMultiThreaded())
-        HinaFlow::Wave::SolveMultiThreaded(input, param, result);
-    else
-        HinaFlow::Wave::Solve(input, param, result);
+    switch (getSolverType())
+    {
+    case 0:
+        if (getMultiThreaded() || input.HISTORY || input.CACHE || param.absorbing_layer > 0 || param.preconditioner != SIM_RawField::PCG_METHOD::PCG_NONE) // Solve is unpreconditioned
+            HinaFlow::Wave::SolveMultiThreaded(input, param, result);
+        else
+            HinaFlow::Wave::Solve(input, param, result);
+        break;
+    case 1: HinaFlow::Wave::SolveExplicit(input, param, result);
+        break;
+    default:
+        throw std::runtime_error("Invalid SolverType");
+    }
 
     return true;
 }
@@ -24,9 +24,16 @@ public:
     inline static auto DATANAME = "SolveWave";
     static constexpr bool UNIQUE_DATANAME = false;
 
+    GETSET_DATA_FUNCS_I("SolverType", SolverType)
     GETSET_DATA_FUNCS_I("PCG_METHOD", PCG_METHOD)
     GETSET_DATA_FUNCS_B("MultiThreaded", MultiThreaded)
+    GETSET_DATA_FUNCS_B("InternalHistory", InternalHistory)
+    GETSET_DATA_FUNCS_B("CacheOperator", CacheOperator)
     GETSET_DATA_FUNCS_F("Wave", Wave)
+    GETSET_DATA_FUNCS_F("CFL", CFL)
+    GETSET_DATA_FUNCS_I("TemporalBlock", TemporalBlock)
+    GETSET_DATA_FUNCS_I("AbsorbingLayer", AbsorbingLayer)
+    GETSET_DATA_FUNCS_F("AbsorbingStrength", AbsorbingStrength)
 
 protected:
     explicit GAS_SolveWave(const SIM_DataFactory* factory): BaseClass(factory) {}
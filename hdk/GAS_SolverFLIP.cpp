@@ -16,6 +16,34 @@
 #include "src/flip.h"
 #include "src/poisson.h"
 
+#include <fstream>
+
+/**
+* Cross-step FLIP state of one node and object: its field buffers (and narrow band level set) and its particle snapshot,
+* whose allocations are reused between steps. Objects never share a context, so they can be solved concurrently.
+* Rewinding the simulation starts from a fresh context.
+*/
+namespace
+{
+    struct FLIPContext
+    {
+        HinaFlow::FLIP::FieldPool POOL;
+        HinaFlow::FLIP::Particles PARTICLES;
+        SIM_Time time = -1;
+    };
+
+    HinaFlow::SolverStates<FLIPContext> CONTEXTS;
+
+    void SET_DETAIL_F(GU_Detail& gdp, const char* name, const double value)
+    {
+        GA_RWAttributeRef attr = gdp.findGlobalAttribute(name);
+        if (!attr.isValid())
+            attr = gdp.addFloatTuple(GA_ATTRIB_DETAIL, name, 1, GA_Defaults(0));
+        GA_RWHandleF handle(attr);
+        handle.set(0, static_cast<float>(value));
+    }
+}
+
 const SIM_DopDescription* GAS_SolverFLIP::getDopDescription()
 {
     static std::vector<PRM_Template> PRMs;
@@ -27,6 +55,35 @@ const SIM_DopDescription* GAS_SolverFLIP::getDopDescription()
     ACTIVATE_GAS_STENCIL
     ACTIVATE_GAS_EXTRAPOLATION
     ACTIVATE_GAS_WEIGHT
+    ACTIVATE_GAS_COLLISION
+
+    static std::array<PRM_Name, 3> Transfer = {
+        PRM_Name("0", "FLIP"),
+        PRM_Name("1", "APIC"),
+        PRM_Name(nullptr),
+    };
+    static PRM_Name TransferName("Transfer", "Transfer");
+    static PRM_Default TransferNameDefault(0);
+    static PRM_ChoiceList CLTransfer(PRM_CHOICELIST_SINGLE, Transfer.data());
+    PRMs.emplace_back(PRM_ORD, 1, &TransferName, &TransferNameDefault, &CLTransfer);
+
+    static std::array<PRM_Name, 4> Advection = {
+        PRM_Name("0", "None"),
+        PRM_Name("1", "RK2"),
+        PRM_Name("2", "RK3"),
+        PRM_Name(nullptr),
+    };
+    static PRM_Name AdvectionName("Advection", "Advection");
+    static PRM_Default AdvectionNameDefault(0);
+    static PRM_ChoiceList CLAdvection(PRM_CHOICELIST_SINGLE, Advection.data());
+    PRMs.emplace_back(PRM_ORD, 1, &AdvectionName, &AdvectionNameDefault, &CLAdvection);
+    PARAMETER_FLOAT(CFL, 1)
+    PARAMETER_INT(MaxSubsteps, 1)
+    PARAMETER_INT(ParticlesPerCell, 0)
+    PARAMETER_INT(NarrowBand, 0)
+    PARAMETER_FILE(StatsFile, "")
+
+    PARAMETER_INT(SortInterval, 0)
     PRMs.emplace_back();
 
     static SIM_DopDescription DESC(GEN_NODE,
@@ -49,6 +106,7 @@ bool GAS_SolverFLIP::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, SIM_T
     SIM_IndexField* MARKER = getIndexField(obj, GAS_NAME_STENCIL); // required
     SIM_IndexField* EX_INDEX = getIndexField(obj, GAS_NAME_EXTRAPOLATION); // optional
     SIM_VectorField* WEIGHT = getVectorField(obj, GAS_NAME_WEIGHT); // required
+    SIM_ScalarField* COLLISION = getScalarField(obj, GAS_NAME_COLLISION); // optional
 
     if (!HinaFlow::CHECK_NOT_NULL(G, V, PRS, MARKER))
     {
@@ -79,12 +137,92 @@ bool GAS_SolverFLIP::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, SIM_T
     if (gdp.getNumPoints() == 0)
         return true;
 
-    HinaFlow::FLIP::Input input{&gdp, V, MARKER};
+    if (const int interval = getSortInterval(); interval > 0 && static_cast<exint>(SYSrint(time / timestep)) % interval == 0)
+        HinaFlow::MORTON_SORT_POINTS(gdp, static_cast<float>(MARKER->getVoxelSize().x()));
+
+    FLIPContext& context = CONTEXTS.Acquire(engine, *this, *obj);
+    if (time <= context.time)
+        context = FLIPContext{};
+    context.time = time;
+    HinaFlow::FLIP::Particles& particles = context.PARTICLES;
+    HinaFlow::FLIP::Input input{&gdp, V, MARKER, &particles, &context.POOL, COLLISION, static_cast<float>(timestep)};
     HinaFlow::FLIP::Param param;
-    HinaFlow::FLIP::Result result{WEIGHT, PRS, DIV, EX_INDEX};
-    HinaFlow::FLIP::P2G(input, param, result);
-    HinaFlow::FLIP::SolvePressure(input, param, result);
-    HinaFlow::FLIP::G2P(input, param, result);
+    param.transfer = getTransfer() == 1 ? HinaFlow::FLIP::Param::Transfer::APIC : HinaFlow::FLIP::Param::Transfer::FLIP;
+    param.advect_order = getAdvection() + 1;
+    param.ppc = static_cast<int>(getParticlesPerCell());
+    param.band_width = static_cast<int>(getNarrowBand());
+    if (param.band_width > 0 && param.ppc <= 0)
+        addError(obj, SIM_MESSAGE, "Narrow band needs Particles Per Cell to refill the band", UT_ERROR_WARNING);
+    HinaFlow::FLIP::Stats stats;
+    HinaFlow::FLIP::Result result{WEIGHT, PRS, DIV, EX_INDEX, &stats};
+    {
+        HinaFlow::ScopedTimer timer(&stats.load);
+        HinaFlow::FLIP::LoadParticles(input, param, particles);
+    }
+
+    // CFL Substeps, only meaningful when the particles are advected here
+    int substeps = 1;
+    if (getAdvection() > 0 && getMaxSubsteps() > 1 && getCFL() > 0)
+    {
+        const float dx = static_cast<float>(MARKER->getVoxelSize().minComponent());
+        const float travel = HinaFlow::FLIP::MaxSpeed(particles) * static_cast<float>(timestep) / (static_cast<float>(getCFL()) * dx);
+        substeps = std::clamp(static_cast<int>(std::ceil(travel)), 1, static_cast<int>(getMaxSubsteps()));
+    }
+    input.dt /= static_cast<float>(substeps);
+
+    for (int _ = 0; _ < substeps; ++_)
+    {
+        stats.particles += static_cast<exint>(particles.pos.size());
+        stats.voxels += MARKER->getField()->field()->numVoxels();
+        HinaFlow::FLIP::P2G(input, param, result);
+        HinaFlow::FLIP::SolvePressure(input, param, result);
+        HinaFlow::FLIP::G2P(input, param, result);
+        if (getAdvection() > 0)
+            HinaFlow::FLIP::Advect(input, param, result);
+    }
+    HinaFlow::FLIP::Reseed(input, param, result);
+    {
+        HinaFlow::ScopedTimer timer(&stats.store);
+        HinaFlow::FLIP::StoreParticles(input, param, particles);
+    }
+
+    GLOBAL_ATTRIBUTE_I(Substeps);
+    Substeps_handle.set(0, substeps);
+
+    // Stage Timings and Throughput, as detail attributes and optionally one CSV row per step
+    const double total = stats.load + stats.bins + stats.weight + stats.marker + stats.extrapolate + stats.pressure + stats.g2p + stats.advect + stats.reseed + stats.store;
+    const std::array<std::pair<const char*, double>, 16> rows = {{
+        {"TimeLoad", stats.load}, {"TimeBins", stats.bins}, {"TimeWeight", stats.weight}, {"TimeMarker", stats.marker},
+        {"TimeExtrapolate", stats.extrapolate}, {"TimePressure", stats.pressure}, {"TimeG2P", stats.g2p}, {"TimeAdvect", stats.advect},
+        {"TimeReseed", stats.reseed}, {"TimeStore", stats.store}, {"TimeTotal", total},
+        {"Particles", static_cast<double>(particles.pos.size())},
+        {"ParticlesPerSecond", total > 0 ? static_cast<double>(stats.particles) / total : 0},
+        {"VoxelsPerSecond", total > 0 ? static_cast<double>(stats.voxels) / total : 0},
+        {"PressureIterations", static_cast<double>(stats.iterations)}, {"PressureResidual", stats.residual},
+    }};
+    for (const auto& [name, value] : rows)
+        SET_DETAIL_F(gdp, name, value);
+
+    if (const std::string path = getStatsFile().toStdString(); !path.empty())
+    {
+        std::ofstream file(path, std::ios::app | std::ios::ate); // ate: tellp is the current file size
+        if (!file)
+            addError(obj, SIM_MESSAGE, "Cannot open the stats file", UT_ERROR_WARNING);
+        else
+        {
+            if (file.tellp() == 0)
+            {
+                file << "object,frame,substeps";
+                for (const auto& row : rows)
+                    file << ',' << row.first;
+                file << '\n';
+            }
+            file << obj->getObjectId() << ',' << engine.getSimulationFrame(time) << ',' << substeps;
+            for (const auto& row : rows)
+                file << ',' << row.second;
+            file << '\n';
+        }
+    }
 
     return true;
 }
@@ -24,6 +24,15 @@ public:
     inline static auto DATANAME = "SolverFLIP";
     static constexpr bool UNIQUE_DATANAME = false;
 
+    GETSET_DATA_FUNCS_I("Transfer", Transfer)
+    GETSET_DATA_FUNCS_I("SortInterval", SortInterval)
+    GETSET_DATA_FUNCS_I("Advection", Advection)
+    GETSET_DATA_FUNCS_F("CFL", CFL)
+    GETSET_DATA_FUNCS_I("MaxSubsteps", MaxSubsteps)
+    GETSET_DATA_FUNCS_I("ParticlesPerCell", ParticlesPerCell)
+    GETSET_DATA_FUNCS_I("NarrowBand", NarrowBand)
+    GETSET_DATA_FUNCS_S("StatsFile", StatsFile)
+
 protected:
     explicit GAS_SolverFLIP(const SIM_DataFactory* factory): BaseClass(factory) {}
     bool solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, SIM_Time time, SIM_Time timestep) override;
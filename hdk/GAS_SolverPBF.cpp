@@ -39,6 +39,7 @@ const SIM_DopDescription* GAS_SolverPBF::getDopDescription()
     PARAMETER_FLOAT(Viscosity, 0.01)
     PARAMETER_FLOAT(DPScale, 1)
     PARAMETER_FLOAT(EPS, 0.01)
+    PARAMETER_INT(SortInterval, 0)
     PRMs.emplace_back();
 
     static SIM_DopDescription DESC(GEN_NODE,
@@ -67,7 +68,8 @@ bool GAS_SolverPBF::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, SIM_Ti
     if (gdp.getNumPoints() == 0)
         return true;
 
-    HinaFlow::PBF::Input input{&gdp, static_cast<float>(timestep)};
+    HinaFlow::PBF::Neighbours neighbours;
+    HinaFlow::PBF::Input input{&gdp, static_cast<float>(timestep), &neighbours};
     HinaFlow::PBF::Param param;
     param.HalfBound = getMaxBound() / 2.f;
     param.TopOpen = getTopOpen();
@@ -93,7 +95,11 @@ bool GAS_SolverPBF::solveGasSubclass(SIM_Engine& engine, SIM_Object* obj, SIM_Ti
     GLOBAL_ATTRIBUTE_I(ExceedMaxIteration);
 
 
+    if (const int interval = getSortInterval(); interval > 0 && static_cast<exint>(SYSrint(time / timestep)) % interval == 0)
+        HinaFlow::MORTON_SORT_POINTS(gdp, param.kernel_radius);
+
     HinaFlow::PBF::Advect(input, param, result);
+    HinaFlow::PBF::BuildNeighbours(input, param, neighbours); // once per step, shared by every pressure iteration
     for (int _ = 0; _ < getPressureIteration(); ++_)
     {
         HinaFlow::PBF::SolvePressure(input, param, result);
@@ -32,6 +32,7 @@ public:
     GETSET_DATA_FUNCS_F("EPS", EPS)
     GETSET_DATA_FUNCS_F("Viscosity", Viscosity)
     GETSET_DATA_FUNCS_F("DPScale", DPScale)
+    GETSET_DATA_FUNCS_I("SortInterval", SortInterval)
 
 protected:
     explicit GAS_SolverPBF(const SIM_DataFactory* factory): BaseClass(factory) {}
@@ -16,33 +16,64 @@
 #include <SIM/SIM_ScalarField.h>
 #include <SIM/SIM_VectorField.h>
 #include <SIM/SIM_IndexField.h>
+#include <UT/UT_SparseMatrix.h>
+
+#include <cstdint>
 
 namespace HinaFlow
 {
     struct Diffusion
     {
+        /**
+        * Assembled implicit systems, one per field sampling, owned by the caller (one per node and object).
+        * Reused by SolveMultiThreaded while diffusion, dt, voxel size and marker content are unchanged.
+        */
+        struct OperatorCache
+        {
+            struct Operator
+            {
+                UT_Vector3I res;
+                std::vector<unsigned char> mask;
+                UT_SparseMatrixRowF A;
+                UT_VectorF inv_diagonal; // Jacobi preconditioner
+            };
+
+            std::vector<Operator> operators;
+            std::uint64_t key = 0;
+        };
+
         struct Input
         {
             SIM_ScalarField* FIELDS = nullptr; // optional, but required if FIELDV is not provided
             SIM_VectorField* FIELDV = nullptr; // optional, but required if FIELDS is not provided
             SIM_IndexField* MARKER = nullptr; // required
             float dt = 1.f; // required
+            std::vector<SIM_ScalarField*> FIELDS_LIST; // optional, more scalar fields sharing the same operator (not used by Solve)
+            std::vector<SIM_VectorField*> FIELDV_LIST; // optional, more vector fields sharing the same operator (not used by Solve)
+            OperatorCache* CACHE = nullptr; // optional, only used by SolveMultiThreaded
         };
 
         struct Param
         {
             SIM_RawField::PCG_METHOD preconditioner = SIM_RawField::PCG_METHOD::PCG_MIC;
             float diffusion = 0.01f;
+            int rkc_stages = 8; // Chebyshev stages per RKC step
+            int temporal_block = 0; // RKC steps advanced per cache tile, 0 sweeps the whole field per stage
         };
 
         struct Result // Results
         {
             SIM_ScalarField* FIELDS = nullptr; // optional, but required if FIELDV is not provided
             SIM_VectorField* FIELDV = nullptr; // optional, but required if FIELDS is not provided
+            std::vector<SIM_ScalarField*> FIELDS_LIST; // optional, matches Input::FIELDS_LIST
+            std::vector<SIM_VectorField*> FIELDV_LIST; // optional, matches Input::FIELDV_LIST
         };
 
         static void Solve(const Input& input, const Param& param, Result& result);
         static void SolveMultiThreaded(const Input& input, const Param& param, Result& result);
+        static void SolveADI(const Input& input, const Param& param, Result& result);
+        static void SolveRKC(const Input& input, const Param& param, Result& result);
+        static void SolveSpectral(const Input& input, const Param& param, Result& result); // requires MARKER to be uniformly Fluid
     };
 }
 
@@ -15,360 +15,1157 @@
 #include "common.h"
 #include "poisson.h"
 
-std::array<SIM_RawField, 3> HinaFlow::FLIP::FLOW_CACHE;
-
 namespace HinaFlow::Internal::FLIP
 {
-    void KnBuildExtrapolateIndexPartial(SIM_RawIndexField* EX_INDEX_OUTPUT, const SIM_RawIndexField* EX_INDEX_INPUT, const SIM_IndexField* MARKER, const int layer, const UT_JobInfo& info)
+    /**
+    * Overwrites the MARKER cells whose center lies inside the collision SDF with CellType::Solid.
+    */
+    void KnRasterizeSolidPartial(SIM_IndexField* MARKER, const SIM_ScalarField* COLLISION, const UT_JobInfo& info)
     {
         UT_VoxelArrayIteratorI vit;
-        vit.setArray(EX_INDEX_OUTPUT->fieldNC());
+        vit.setArray(MARKER->getField()->fieldNC());
         vit.setCompressOnExit(true);
         vit.setPartialRange(info.job(), info.numJobs());
 
         for (vit.rewind(); !vit.atEnd(); vit.advance())
         {
-            const UT_Vector3I cell(vit.x(), vit.y(), vit.z());
-            if (layer == 0)
+            if (COLLISION->getValue(MARKER->getField()->indexToPos(UT_Vector3I(vit.x(), vit.y(), vit.z()))) < 0)
+                vit.setValue(static_cast<exint>(CellType::Solid));
+        }
+    }
+
+    THREADED_METHOD2(, MARKER->getField()->shouldMultiThread(), KnRasterizeSolid, SIM_IndexField*, MARKER, const SIM_ScalarField*, COLLISION);
+
+    static void RasterizeSolid(SIM_IndexField* MARKER, const SIM_ScalarField* COLLISION)
+    {
+        if (!COLLISION)
+            return;
+        fpreal32 value = 0;
+        if (COLLISION->getField()->field()->isConstant(&value) && value >= 0)
+            return;
+        KnRasterizeSolid(MARKER, COLLISION);
+    }
+
+    /**
+    * Particles sorted by the cell containing them, with a counting sort.
+    * Positions and velocities are stored in sorted order, so each gather reads contiguous memory.
+    */
+    struct ParticleBins
+    {
+        UT_Vector3I res; // cells per axis
+        UT_Vector3 origin; // center of cell (0, 0, 0)
+        UT_Vector3 dx; // cell size
+        std::vector<exint> start; // particles of cell k are [start[k], start[k + 1])
+        std::vector<UT_Vector3> pos; // sorted by cell
+        std::vector<UT_Vector3> vel; // sorted by cell
+        std::vector<exint> index; // particle index, sorted by cell
+        std::array<std::vector<UT_Vector3>, 3> affine; // APIC only, sorted by cell
+    };
+
+    static UT_Vector3I CELL_OF(const ParticleBins& bins, const UT_Vector3& pos)
+    {
+        UT_Vector3I cell;
+        for (int AXIS : {0, 1, 2})
+            cell[AXIS] = static_cast<exint>(std::floor((pos[AXIS] - bins.origin[AXIS]) / bins.dx[AXIS] + 0.5f));
+        return cell;
+    }
+
+    static exint CELL_INDEX(const UT_Vector3& pos, const UT_Vector3I& res, const UT_Vector3& origin, const UT_Vector3& dx)
+    {
+        UT_Vector3I cell;
+        bool inside = true;
+        for (int AXIS : {0, 1, 2})
+        {
+            cell[AXIS] = static_cast<exint>(std::floor((pos[AXIS] - origin[AXIS]) / dx[AXIS] + 0.5f));
+            inside &= cell[AXIS] >= 0 && cell[AXIS] < res[AXIS];
+        }
+        return inside ? TO_1D_IDX(cell, res) : -1;
+    }
+
+    static void BuildParticleBins(ParticleBins& bins, const SIM_RawIndexField* CELLS, const HinaFlow::FLIP::Particles& particles)
+    {
+        bins.res = CELLS->getVoxelRes();
+        bins.origin = CELLS->indexToPos(UT_Vector3I(0, 0, 0));
+        bins.dx = CELLS->getVoxelSize();
+
+        const exint n = static_cast<exint>(particles.pos.size());
+        const exint cells = bins.res.x() * bins.res.y() * bins.res.z();
+
+        // Counting Sort, cells keep their particles in index order
+        COUNTING_SORT(particles.cell, cells, bins.start, bins.index);
+        const exint binned = bins.start[cells];
+
+        bins.pos.resize(binned);
+        bins.vel.resize(binned);
+        const bool apic = particles.affine[0].size() == particles.pos.size() && n > 0;
+        for (auto& affine : bins.affine)
+            affine.resize(apic ? binned : 0);
+        UTparallelFor(UT_BlockedRange<exint>(0, binned), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint s = r.begin(); s < r.end(); ++s)
             {
-                if (CHECK_CELL_TYPE<CellType::Fluid>(MARKER, cell))
-                    vit.setValue(0);
+                const exint i = bins.index[s];
+                bins.pos[s] = particles.pos[i];
+                bins.vel[s] = particles.vel[i];
+                if (apic)
+                    for (int AXIS : {0, 1, 2})
+                        bins.affine[AXIS][s] = particles.affine[AXIS][i];
             }
-            else
-            {
-                if (SIM::FieldUtils::getFieldValue(*EX_INDEX_INPUT, cell) < layer)
-                    continue;
-                for (const int AXIS : GET_AXIS_ITER(EX_INDEX_INPUT))
-                {
-                    for (const int DIR : {0, 1})
+        });
+    }
+
+    /**
+    * Gathers particle velocities onto the AXIS face samples with trilinear (tent) weights,
+    * visiting only the cells within one voxel of each sample, so no two threads write the same voxel.
+    * With APIC the particle velocity is first extended to the sample by its affine row, v + c . (x_face - x_p).
+    * FIELD gets the weighted average, WEIGHT (optional) the total weight.
+    */
+    void KnTransferToFacePartial(SIM_RawField* FIELD, SIM_RawField* WEIGHT, const ParticleBins& bins, const int AXIS, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorF vit;
+        vit.setArray(FIELD->fieldNC());
+        vit.setCompressOnExit(true);
+        vit.setPartialRange(info.job(), info.numJobs());
+
+        UT_VoxelArrayIteratorF wit;
+        if (WEIGHT)
+        {
+            wit.setArray(WEIGHT->fieldNC());
+            wit.setCompressOnExit(true);
+            wit.setPartialRange(info.job(), info.numJobs());
+            wit.rewind();
+        }
+
+        const std::vector<int> axes = GET_AXIS_ITER(FIELD);
+        const std::vector<UT_Vector3>* affine = bins.affine[AXIS].empty() ? nullptr : &bins.affine[AXIS];
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+        {
+            const UT_Vector3 sample = FIELD->indexToPos(UT_Vector3I(vit.x(), vit.y(), vit.z()));
+            const UT_Vector3I lo = CELL_OF(bins, sample - bins.dx);
+            const UT_Vector3I hi = CELL_OF(bins, sample + bins.dx);
+
+            float sum_w = 0, sum_wv = 0;
+            for (exint z = std::max<exint>(lo.z(), 0); z <= std::min(hi.z(), bins.res.z() - 1); ++z)
+                for (exint y = std::max<exint>(lo.y(), 0); y <= std::min(hi.y(), bins.res.y() - 1); ++y)
+                    for (exint x = std::max<exint>(lo.x(), 0); x <= std::min(hi.x(), bins.res.x() - 1); ++x)
                     {
-                        const UT_Vector3I cell1 = SIM::FieldUtils::cellToCellMap(cell, AXIS, DIR);
-                        if (CHECK_CELL_VALID(EX_INDEX_INPUT, cell1) && SIM::FieldUtils::getFieldValue(*EX_INDEX_INPUT, cell1) == layer - 1)
-                            vit.setValue(layer);
+                        const exint k = TO_1D_IDX(UT_Vector3I(x, y, z), bins.res);
+                        for (exint p = bins.start[k]; p < bins.start[k + 1]; ++p)
+                        {
+                            float w = 1;
+                            for (const int A : axes)
+                                w *= std::max(0.f, 1.f - std::abs(bins.pos[p][A] - sample[A]) / bins.dx[A]);
+                            sum_w += w;
+                            sum_wv += w * (affine ? bins.vel[p][AXIS] + (*affine)[p].dot(sample - bins.pos[p]) : bins.vel[p][AXIS]);
+                        }
                     }
-                }
+
+            vit.setValue(sum_w > 0 ? sum_wv / sum_w : 0.f);
+            if (WEIGHT)
+            {
+                wit.setValue(sum_w);
+                wit.advance();
             }
         }
     }
 
-    THREADED_METHOD4(, EX_INDEX_OUTPUT->shouldMultiThread(), KnBuildExtrapolateIndex, SIM_RawIndexField *, EX_INDEX_OUTPUT, const SIM_RawIndexField*, EX_INDEX_INPUT, const SIM_IndexField*, MARKER, const int, layer);
+    THREADED_METHOD4(, FIELD->shouldMultiThread(), KnTransferToFace, SIM_RawField*, FIELD, SIM_RawField*, WEIGHT, const ParticleBins&, bins, const int, AXIS);
 
-    void KnExtrapolatePartial(SIM_RawField* FIELD, const SIM_RawIndexField* EX_INDEX, const int distance, const int AXIS, const UT_JobInfo& info)
+    static void BuildWeight(SIM_VectorField* WEIGHT, SIM_VectorField* FLOW, const ParticleBins& bins)
     {
-        UT_VoxelArrayIteratorF vit;
-        vit.setArray(FIELD->fieldNC());
+        for (const int AXIS : GET_AXIS_ITER(FLOW))
+            KnTransferToFace(FLOW->getField(AXIS), WEIGHT ? WEIGHT->getField(AXIS) : nullptr, bins, AXIS);
+    }
+
+
+    void KnBuildMarkerFromBinsPartial(SIM_IndexField* MARKER, const ParticleBins& bins, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorI vit;
+        vit.setArray(MARKER->getField()->fieldNC());
         vit.setCompressOnExit(true);
         vit.setPartialRange(info.job(), info.numJobs());
 
         for (vit.rewind(); !vit.atEnd(); vit.advance())
         {
-            const UT_Vector3I face(vit.x(), vit.y(), vit.z());
-            const UT_Vector3I cell1 = SIM::FieldUtils::faceToCellMap(face, AXIS, 0);
-            const UT_Vector3I cell2 = SIM::FieldUtils::faceToCellMap(face, AXIS, 1);
+            const exint k = TO_1D_IDX(UT_Vector3I(vit.x(), vit.y(), vit.z()), bins.res);
+            vit.setValue(static_cast<exint>(bins.start[k + 1] > bins.start[k] ? CellType::Fluid : CellType::Empty));
+        }
+    }
 
-            const bool cell1_valid = CHECK_CELL_VALID(EX_INDEX, cell1);
-            const bool cell2_valid = CHECK_CELL_VALID(EX_INDEX, cell2);
+    THREADED_METHOD2(, MARKER->getField()->shouldMultiThread(), KnBuildMarkerFromBins, SIM_IndexField*, MARKER, const ParticleBins&, bins);
 
-            if (cell1_valid && SIM::FieldUtils::getFieldValue(*EX_INDEX, cell1) == distance || cell2_valid && SIM::FieldUtils::getFieldValue(*EX_INDEX, cell2) == distance)
+    static void BuildMarker(SIM_IndexField* MARKER, const ParticleBins& bins, const SIM_ScalarField* COLLISION)
+    {
+        KnBuildMarkerFromBins(MARKER, bins);
+        RasterizeSolid(MARKER, COLLISION);
+    }
+
+    /**
+    * Flat copy of a raw field, so many threads can sample it trilinearly without voxel array tile lookups.
+    * Positions outside the samples are clamped to the border, like SIM_RawField::getValue.
+    */
+    struct FlatField
+    {
+        UT_Vector3I res;
+        UT_Vector3 origin; // position of sample (0, 0, 0)
+        UT_Vector3 inv_dx;
+        std::vector<float> data;
+
+        float Sample(const UT_Vector3& pos) const
+        {
+            exint i0[3], i1[3];
+            float f[3];
+            for (int AXIS : {0, 1, 2})
             {
-                float sum = 0;
-                int count = 0;
-                for (const int A_AXIS : GET_AXIS_ITER(FIELD))
+                if (res[AXIS] == 1)
                 {
-                    for (const int DIR : {0, 1})
-                    {
-                        const UT_Vector3I face_around = SIM::FieldUtils::cellToCellMap(face, A_AXIS, DIR);
-                        const UT_Vector3I cell1_around = SIM::FieldUtils::faceToCellMap(face_around, AXIS, 0);
-                        const UT_Vector3I cell2_around = SIM::FieldUtils::faceToCellMap(face_around, AXIS, 1);
+                    i0[AXIS] = i1[AXIS] = 0;
+                    f[AXIS] = 0;
+                    continue;
+                }
+                const float g = std::clamp((pos[AXIS] - origin[AXIS]) * inv_dx[AXIS], 0.f, static_cast<float>(res[AXIS] - 1));
+                i0[AXIS] = std::min(static_cast<exint>(g), res[AXIS] - 2);
+                i1[AXIS] = i0[AXIS] + 1;
+                f[AXIS] = g - static_cast<float>(i0[AXIS]);
+            }
 
-                        const bool cell1_around_valid = CHECK_CELL_VALID(EX_INDEX, cell1_around);
-                        const bool cell2_around_valid = CHECK_CELL_VALID(EX_INDEX, cell2_around);
+            const exint sy = res.x(), sz = res.x() * res.y();
+            const float* d = data.data();
+            const float c00 = d[i0[0] + sy * i0[1] + sz * i0[2]] * (1 - f[0]) + d[i1[0] + sy * i0[1] + sz * i0[2]] * f[0];
+            const float c10 = d[i0[0] + sy * i1[1] + sz * i0[2]] * (1 - f[0]) + d[i1[0] + sy * i1[1] + sz * i0[2]] * f[0];
+            const float c01 = d[i0[0] + sy * i0[1] + sz * i1[2]] * (1 - f[0]) + d[i1[0] + sy * i0[1] + sz * i1[2]] * f[0];
+            const float c11 = d[i0[0] + sy * i1[1] + sz * i1[2]] * (1 - f[0]) + d[i1[0] + sy * i1[1] + sz * i1[2]] * f[0];
+            return (c00 * (1 - f[1]) + c10 * f[1]) * (1 - f[2]) + (c01 * (1 - f[1]) + c11 * f[1]) * f[2];
+        }
 
-                        if (cell1_valid && cell1_around_valid && SIM::FieldUtils::getFieldValue(*EX_INDEX, cell1_around) == distance - 1
-                            || cell2_valid && cell2_around_valid && SIM::FieldUtils::getFieldValue(*EX_INDEX, cell2_around) == distance - 1)
-                        {
-                            sum += SIM::FieldUtils::getFieldValue(*FIELD, face_around);
-                            ++count;
-                        }
-                    }
+        /**
+        * Gradient of the trilinear interpolant at POS, zero along flat axes.
+        */
+        UT_Vector3 Gradient(const UT_Vector3& pos) const
+        {
+            exint i[2][3];
+            float f[3];
+            for (int AXIS : {0, 1, 2})
+            {
+                if (res[AXIS] == 1)
+                {
+                    i[0][AXIS] = i[1][AXIS] = 0;
+                    f[AXIS] = 0;
+                    continue;
                 }
-                if (count)
-                    vit.setValue(sum / static_cast<float>(count));
-                else
-                    vit.setValue(0); // TODO: check here
+                const float g = std::clamp((pos[AXIS] - origin[AXIS]) * inv_dx[AXIS], 0.f, static_cast<float>(res[AXIS] - 1));
+                i[0][AXIS] = std::min(static_cast<exint>(g), res[AXIS] - 2);
+                i[1][AXIS] = i[0][AXIS] + 1;
+                f[AXIS] = g - static_cast<float>(i[0][AXIS]);
             }
+
+            const exint sy = res.x(), sz = res.x() * res.y();
+            UT_Vector3 grad(0, 0, 0);
+            for (int c = 0; c < 8; ++c)
+            {
+                const int b[3] = {c & 1, (c >> 1) & 1, (c >> 2) & 1};
+                const float value = data[i[b[0]][0] + sy * i[b[1]][1] + sz * i[b[2]][2]];
+                for (int AXIS : {0, 1, 2})
+                {
+                    float w = (b[AXIS] ? 1.f : -1.f) * inv_dx[AXIS];
+                    for (int OTHER : {0, 1, 2})
+                        if (OTHER != AXIS)
+                            w *= b[OTHER] ? f[OTHER] : 1 - f[OTHER];
+                    grad[AXIS] += w * value;
+                }
+            }
+            for (int AXIS : {0, 1, 2})
+                if (res[AXIS] == 1)
+                    grad[AXIS] = 0;
+            return grad;
         }
+    };
+
+    void KnLoadFlatFieldPartial(std::vector<float>& data, const SIM_RawField* FIELD, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorF vit;
+        vit.setConstArray(FIELD->field());
+        vit.setPartialRange(info.job(), info.numJobs());
+
+        const UT_Vector3I res = FIELD->getVoxelRes();
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+            data[TO_1D_IDX(UT_Vector3I(vit.x(), vit.y(), vit.z()), res)] = vit.getValue();
+    }
+
+    THREADED_METHOD2(, FIELD->shouldMultiThread(), KnLoadFlatField, std::vector<float>&, data, const SIM_RawField*, FIELD);
+
+    static void DescribeFlatField(FlatField& flat, const SIM_RawField* FIELD)
+    {
+        flat.res = FIELD->getVoxelRes();
+        flat.origin = FIELD->indexToPos(UT_Vector3I(0, 0, 0));
+        const UT_Vector3 dx = FIELD->getVoxelSize();
+        flat.inv_dx = UT_Vector3(1.f / dx.x(), 1.f / dx.y(), 1.f / dx.z());
+    }
+
+    static void LoadFlatField(FlatField& flat, const SIM_RawField* FIELD)
+    {
+        DescribeFlatField(flat, FIELD);
+        flat.data.resize(FIELD->field()->numVoxels());
+        KnLoadFlatField(flat.data, FIELD);
     }
 
-    THREADED_METHOD4(, EX_INDEX->shouldMultiThread(), KnExtrapolate, SIM_RawField*, FIELD, const SIM_RawIndexField*, EX_INDEX, const int, distance, const int, AXIS);
+    void KnStoreFlatFieldPartial(SIM_RawField* FIELD, const std::vector<float>& data, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorF vit;
+        vit.setArray(FIELD->fieldNC());
+        vit.setCompressOnExit(true);
+        vit.setPartialRange(info.job(), info.numJobs());
+
+        const UT_Vector3I res = FIELD->getVoxelRes();
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+            vit.setValue(data[TO_1D_IDX(UT_Vector3I(vit.x(), vit.y(), vit.z()), res)]);
+    }
+
+    THREADED_METHOD2(, FIELD->shouldMultiThread(), KnStoreFlatField, SIM_RawField*, FIELD, const std::vector<float>&, data);
+
 
+    void KnLoadFluidCellsPartial(std::vector<unsigned char>& fluid, const SIM_IndexField* MARKER, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorI vit;
+        vit.setConstArray(MARKER->getField()->field());
+        vit.setPartialRange(info.job(), info.numJobs());
 
-    void KnBuildMarkerPartial(SIM_IndexField* MARKER, const SIM_VectorField* FLOW, const UT_JobInfo& info)
+        const UT_Vector3I res = MARKER->getField()->getVoxelRes();
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+            fluid[TO_1D_IDX(UT_Vector3I(vit.x(), vit.y(), vit.z()), res)] = vit.getValue() == static_cast<exint>(CellType::Fluid);
+    }
+
+    THREADED_METHOD2(, MARKER->getField()->shouldMultiThread(), KnLoadFluidCells, std::vector<unsigned char>&, fluid, const SIM_IndexField*, MARKER);
+
+    void KnStoreFluidCellsPartial(SIM_IndexField* MARKER, const std::vector<unsigned char>& fluid, const UT_JobInfo& info)
     {
         UT_VoxelArrayIteratorI vit;
         vit.setArray(MARKER->getField()->fieldNC());
         vit.setCompressOnExit(true);
         vit.setPartialRange(info.job(), info.numJobs());
 
+        const UT_Vector3I res = MARKER->getField()->getVoxelRes();
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+            vit.setValue(static_cast<exint>(fluid[TO_1D_IDX(UT_Vector3I(vit.x(), vit.y(), vit.z()), res)] ? CellType::Fluid : CellType::Empty));
+    }
+
+    THREADED_METHOD2(, MARKER->getField()->shouldMultiThread(), KnStoreFluidCells, SIM_IndexField*, MARKER, const std::vector<unsigned char>&, fluid);
+
+
+    void KnStoreDistancePartial(SIM_RawIndexField* EX_INDEX, const std::vector<int>& distance, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorI vit;
+        vit.setArray(EX_INDEX->fieldNC());
+        vit.setCompressOnExit(true);
+        vit.setPartialRange(info.job(), info.numJobs());
+
+        const UT_Vector3I res = EX_INDEX->getVoxelRes();
+
         for (vit.rewind(); !vit.atEnd(); vit.advance())
         {
-            if (FLOW->getCellValue(vit.x(), vit.y(), vit.z()).length2() > 0)
-                vit.setValue(static_cast<exint>(CellType::Fluid));
-            else
-                vit.setValue(static_cast<exint>(CellType::Empty));
+            const int d = distance[TO_1D_IDX(UT_Vector3I(vit.x(), vit.y(), vit.z()), res)];
+            vit.setValue(d < 0 ? 114514 : d);
         }
     }
 
-    THREADED_METHOD2(, MARKER->getField()->shouldMultiThread(), KnBuildMarker, SIM_IndexField*, MARKER, const SIM_VectorField*, FLOW);
+    THREADED_METHOD2(, EX_INDEX->shouldMultiThread(), KnStoreDistance, SIM_RawIndexField*, EX_INDEX, const std::vector<int>&, distance);
+
 
-    static void BuildMarker(SIM_IndexField* MARKER, const SIM_VectorField* FLOW)
+    template <typename Visit>
+    void FOR_EACH_NEIGHBOUR(const UT_Vector3I& res, const exint idx, Visit visit)
     {
-        KnBuildMarker(MARKER, FLOW);
+        const UT_Vector3I c = TO_3D_IDX(idx, res);
+        const exint stride[3] = {1, res.x(), res.x() * res.y()};
+        for (int AXIS : {0, 1, 2})
+        {
+            if (c[AXIS] > 0)
+                visit(idx - stride[AXIS]);
+            if (c[AXIS] < res[AXIS] - 1)
+                visit(idx + stride[AXIS]);
+        }
     }
 
-    static void BuildMarker(SIM_IndexField* MARKER, const GU_Detail* gdp)
+    /**
+    * Breadth-first layers on a flat grid. DISTANCE is 0 for known samples and -1 for unknown ones.
+    * Layer L is the unknown 6-neighbours of layer L - 1, gets DISTANCE = L and is handed to LAYER(L, frontier).
+    * Besides the one parallel seeding scan, work is proportional to the band actually filled.
+    * Each layer is gathered in parallel per frontier block, then sorted and deduplicated, so frontiers are in index order.
+    */
+    template <typename Layer>
+    void BFS_LAYERS(const UT_Vector3I& res, std::vector<int>& distance, const int depth, Layer layer)
     {
-        MARKER->getField()->makeConstant(static_cast<exint>(CellType::Empty));
-        GA_Offset pt_off;
-        GA_FOR_ALL_PTOFF(gdp, pt_off)
+        if (depth < 1)
+            return;
+
+        // Seed, one list per z slice to keep the order deterministic
+        std::vector<std::vector<exint>> seeds(res.z());
+        UTparallelFor(UT_BlockedRange<exint>(0, res.z()), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint z = r.begin(); z < r.end(); ++z)
+            {
+                const exint begin = z * res.x() * res.y(), end = begin + res.x() * res.y();
+                for (exint idx = begin; idx < end; ++idx)
+                {
+                    if (distance[idx] >= 0)
+                        continue;
+                    bool next_to_known = false;
+                    FOR_EACH_NEIGHBOUR(res, idx, [&](const exint n) { next_to_known |= distance[n] == 0; });
+                    if (next_to_known)
+                        seeds[z].push_back(idx);
+                }
+            }
+        });
+
+        std::vector<exint> frontier;
+        for (const std::vector<exint>& seed : seeds)
+            frontier.insert(frontier.end(), seed.begin(), seed.end());
+        UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(frontier.size())), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint i = r.begin(); i < r.end(); ++i)
+                distance[frontier[i]] = 1;
+        });
+
+        for (int L = 1; L <= depth && !frontier.empty(); ++L)
         {
-            const UT_Vector3 pos = gdp->getPos3(pt_off);
-            SIM::FieldUtils::setFieldValue(*MARKER->getField(), MARKER->getField()->posToIndex(pos), static_cast<exint>(CellType::Fluid));
+            layer(L, frontier);
+            if (L == depth)
+                break;
+
+            // Unknown neighbours, one list per frontier block
+            constexpr exint BLOCK = 4096;
+            const exint size = static_cast<exint>(frontier.size());
+            std::vector<std::vector<exint>> candidates((size + BLOCK - 1) / BLOCK);
+            UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(candidates.size())), [&](const UT_BlockedRange<exint>& r)
+            {
+                for (exint b = r.begin(); b < r.end(); ++b)
+                    for (exint i = b * BLOCK; i < std::min(size, (b + 1) * BLOCK); ++i)
+                        FOR_EACH_NEIGHBOUR(res, frontier[i], [&](const exint n)
+                        {
+                            if (distance[n] < 0)
+                                candidates[b].push_back(n);
+                        });
+            });
+
+            // Concatenate, then drop the cells reached from more than one frontier sample
+            std::vector<exint> offset(candidates.size() + 1, 0);
+            for (size_t b = 0; b < candidates.size(); ++b)
+                offset[b + 1] = offset[b] + static_cast<exint>(candidates[b].size());
+            std::vector<exint> next(offset.back());
+            UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(candidates.size())), [&](const UT_BlockedRange<exint>& r)
+            {
+                for (exint b = r.begin(); b < r.end(); ++b)
+                    std::copy(candidates[b].begin(), candidates[b].end(), next.begin() + offset[b]);
+            });
+            UTparallelSort(next.begin(), next.end());
+            next.erase(std::unique(next.begin(), next.end()), next.end());
+
+            UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(next.size())), [&](const UT_BlockedRange<exint>& r)
+            {
+                for (exint i = r.begin(); i < r.end(); ++i)
+                    distance[next[i]] = L + 1;
+            });
+            frontier.swap(next);
         }
     }
 
-    static void BuildWeight(SIM_VectorField* WEIGHT, SIM_VectorField* FLOW, GU_Detail* in_gdp)
+    /**
+    * Extends face velocities into the air by BFS layers from the faces next to fluid cells.
+    * Each new face takes the average of its already known face neighbours.
+    * EX_INDEX (optional) receives the cell distance to the fluid, 114514 beyond the band.
+    */
+    static void Extrapolate(SIM_VectorField* FLOW, const SIM_IndexField* MARKER, SIM_IndexField* EX_INDEX, const int distance)
     {
-        GU_Detail& gdp = *in_gdp;
-        POINT_ATTRIBUTE_V3(v)
+        const UT_Vector3I cell_res = MARKER->getField()->getVoxelRes();
+        std::vector<unsigned char> fluid(MARKER->getField()->field()->numVoxels());
+        KnLoadFluidCells(fluid, MARKER);
+
+        if (EX_INDEX)
+        {
+            std::vector<int> cell_distance(fluid.size());
+            UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(fluid.size())), [&](const UT_BlockedRange<exint>& r)
+            {
+                for (exint i = r.begin(); i < r.end(); ++i)
+                    cell_distance[i] = fluid[i] ? 0 : -1;
+            });
+            BFS_LAYERS(cell_res, cell_distance, distance, [](int, const std::vector<exint>&) {});
+            KnStoreDistance(EX_INDEX->getField(), cell_distance);
+        }
+
         for (const int AXIS : GET_AXIS_ITER(FLOW))
         {
-            SIM_RawField* WEIGHT_RAW = nullptr;
-            if (WEIGHT)
-                WEIGHT_RAW = WEIGHT->getField(AXIS);
-            else
-                WEIGHT_RAW = new SIM_RawField(*FLOW->getField(AXIS));
-            FLOW->getField(AXIS)->makeConstant(0);
+            SIM_RawField* FIELD = FLOW->getField(AXIS);
+            const UT_Vector3I res = FIELD->getVoxelRes();
+            std::vector<float> data(FIELD->field()->numVoxels());
+            KnLoadFlatField(data, FIELD);
 
-            const auto voxvol = static_cast<float>(WEIGHT_RAW->getVoxelVolume());
-            GA_Offset pt_off;
-            GA_FOR_ALL_PTOFF(in_gdp, pt_off)
+            // Known faces touch a fluid cell
+            std::vector<int> face_distance(data.size());
+            UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(data.size())), [&](const UT_BlockedRange<exint>& r)
             {
-                const UT_Vector3 pos = in_gdp->getPos3(pt_off);
-                const UT_Vector3 vel = v_handle.get(pt_off);
-                const UT_Vector3I cell = WEIGHT_RAW->posToIndex(pos);
-                const UT_Vector3 center = WEIGHT_RAW->indexToPos(cell);
-                const UT_Vector3 delta = pos - center;
-
-                std::vector<UT_Vector3> cells;
-                cells.resize(8, cell);
-                for (int i = 1; i < 8; ++i)
+                for (exint idx = r.begin(); idx < r.end(); ++idx)
                 {
-                    if (i & 0x1)
-                        cells[i].x() += delta[0] < 0 ? -1 : 1;
-                    else if (i & 0x2)
-                        cells[i].y() += delta[1] < 0 ? -1 : 1;
-                    else if (i & 0x4)
-                        cells[i].z() += delta[2] < 0 ? -1 : 1;
+                    const UT_Vector3I face = TO_3D_IDX(idx, res);
+                    bool known = false;
+                    for (const int DIR : {0, 1})
+                    {
+                        const UT_Vector3I cell = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR);
+                        if (cell[AXIS] >= 0 && cell[AXIS] < cell_res[AXIS])
+                            known |= fluid[TO_1D_IDX(cell, cell_res)] != 0;
+                    }
+                    face_distance[idx] = known ? 0 : -1;
                 }
+            });
 
-                if (const auto dim = GET_AXIS_ITER(FLOW).size(); dim == 3)
+            BFS_LAYERS(res, face_distance, distance, [&](const int L, const std::vector<exint>& frontier)
+            {
+                UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(frontier.size())), [&](const UT_BlockedRange<exint>& r)
                 {
-                    float w000 = delta.x() * delta.y() * delta.z() / voxvol;
-                    float w001 = (1 - delta.x()) * delta.y() * delta.z() / voxvol;
-                    float w010 = delta.x() * (1 - delta.y()) * delta.z() / voxvol;
-                    float w011 = (1 - delta.x()) * (1 - delta.y()) * delta.z() / voxvol;
-                    float w100 = delta.x() * delta.y() * (1 - delta.z()) / voxvol;
-                    float w101 = (1 - delta.x()) * delta.y() * (1 - delta.z()) / voxvol;
-                    float w110 = delta.x() * (1 - delta.y()) * (1 - delta.z()) / voxvol;
-                    float w111 = (1 - delta.x()) * (1 - delta.y()) * (1 - delta.z()) / voxvol;
-
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[0]))
-                        w000 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[1]))
-                        w001 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[2]))
-                        w010 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[3]))
-                        w011 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[4]))
-                        w100 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[5]))
-                        w101 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[6]))
-                        w110 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[7]))
-                        w111 = 0;
-
-                    const float sum = w000 + w001 + w010 + w011 + w100 + w101 + w110 + w111;
-                    if (sum > 0)
+                    for (exint i = r.begin(); i < r.end(); ++i)
                     {
-                        if (w000 > 0)
-                        {
-                            const float weight = w000 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[0], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[0]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[0], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[0]) + weight * vel[AXIS]);
-                        }
-                        if (w001 > 0)
+                        float sum = 0;
+                        int count = 0;
+                        FOR_EACH_NEIGHBOUR(res, frontier[i], [&](const exint n)
                         {
-                            const float weight = w001 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[1], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[1]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[1], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[1]) + weight * vel[AXIS]);
-                        }
-                        if (w010 > 0)
-                        {
-                            const float weight = w010 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[2], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[2]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[2], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[2]) + weight * vel[AXIS]);
-                        }
-                        if (w011 > 0)
-                        {
-                            const float weight = w011 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[3], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[3]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[3], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[3]) + weight * vel[AXIS]);
-                        }
-                        if (w100 > 0)
-                        {
-                            const float weight = w100 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[4], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[4]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[4], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[4]) + weight * vel[AXIS]);
-                        }
-                        if (w101 > 0)
-                        {
-                            const float weight = w101 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[5], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[5]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[5], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[5]) + weight * vel[AXIS]);
-                        }
-                        if (w110 > 0)
-                        {
-                            const float weight = w110 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[6], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[6]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[6], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[6]) + weight * vel[AXIS]);
-                        }
-                        if (w111 > 0)
-                        {
-                            const float weight = w111 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[7], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[7]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[7], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[7]) + weight * vel[AXIS]);
-                        }
+                            if (face_distance[n] >= 0 && face_distance[n] < L)
+                            {
+                                sum += data[n];
+                                ++count;
+                            }
+                        });
+                        data[frontier[i]] = count ? sum / static_cast<float>(count) : 0.f;
                     }
+                });
+            });
+
+            KnStoreFlatField(FIELD, data);
+        }
+    }
+
+    static void DescribeCells(FlatField& flat, const ParticleBins& bins)
+    {
+        flat.res = bins.res;
+        flat.origin = bins.origin;
+        flat.inv_dx = UT_Vector3(1.f / bins.dx.x(), 1.f / bins.dx.y(), 1.f / bins.dx.z());
+    }
+
+    /**
+    * Narrow band P2G: the liquid is the cells holding particles plus the interior of the level set,
+    * advected semi-Lagrangian through the previous projected velocity (pool.flow_post).
+    * Faces with no particle nearby but touching the interior take the advected previous velocity,
+    * MARKER receives the liquid and solid cells, and the level set is rebuilt as the signed cell distance to the air.
+    */
+    static void NarrowBand(SIM_VectorField* FLOW, SIM_IndexField* MARKER, const SIM_ScalarField* COLLISION, HinaFlow::FLIP::FieldPool& pool, const ParticleBins& bins, const float dt, const int band_width)
+    {
+        const UT_Vector3I res = bins.res;
+        const exint cells = res.x() * res.y() * res.z();
+        const std::vector<int> axes = GET_AXIS_ITER(FLOW);
+        auto has_particles = [&](const exint k) { return bins.start[k + 1] > bins.start[k]; };
+
+        // Previous grid velocity, only usable when the resolution did not change
+        bool has_history = pool.level_set.size() == static_cast<size_t>(cells);
+        for (const int AXIS : axes)
+            has_history &= pool.flow_post[AXIS].size() == static_cast<size_t>(FLOW->getField(AXIS)->field()->numVoxels());
+
+        std::array<FlatField, 3> FLOW_OLD;
+        FlatField PHI;
+        std::vector<float> phi(cells, 1.f);
+        if (has_history)
+        {
+            for (const int AXIS : axes)
+            {
+                DescribeFlatField(FLOW_OLD[AXIS], FLOW->getField(AXIS));
+                FLOW_OLD[AXIS].data.swap(pool.flow_post[AXIS]);
+            }
+            DescribeCells(PHI, bins);
+            PHI.data.swap(pool.level_set);
+        }
+        auto velocity = [&](const UT_Vector3& pos)
+        {
+            UT_Vector3 vel(0, 0, 0);
+            for (const int AXIS : axes)
+                vel[AXIS] = FLOW_OLD[AXIS].Sample(pos);
+            return vel;
+        };
+
+        // Advect Level Set
+        if (has_history)
+            UTparallelFor(UT_BlockedRange<exint>(0, cells), [&](const UT_BlockedRange<exint>& r)
+            {
+                for (exint k = r.begin(); k < r.end(); ++k)
+                {
+                    const UT_Vector3I cell = TO_3D_IDX(k, res);
+                    UT_Vector3 pos = bins.origin;
+                    for (int AXIS : {0, 1, 2})
+                        pos[AXIS] += static_cast<float>(cell[AXIS]) * bins.dx[AXIS];
+                    phi[k] = PHI.Sample(pos - dt * velocity(pos));
                 }
-                else if (dim == 2)
+            });
+
+        // Interior Faces
+        if (has_history)
+            for (const int AXIS : axes)
+            {
+                SIM_RawField* FIELD = FLOW->getField(AXIS);
+                const UT_Vector3I face_res = FIELD->getVoxelRes();
+                std::vector<float> data(FIELD->field()->numVoxels());
+                KnLoadFlatField(data, FIELD);
+                UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(data.size())), [&](const UT_BlockedRange<exint>& r)
                 {
-                    const int AXIS1 = GET_AXIS_ITER(FLOW)[0];
-                    const int AXIS2 = GET_AXIS_ITER(FLOW)[1];
-                    float w00 = delta[AXIS1] * delta[AXIS2] / voxvol;
-                    float w01 = (1 - delta[AXIS1]) * delta[AXIS2] / voxvol;
-                    float w10 = delta[AXIS1] * (1 - delta[AXIS2]) / voxvol;
-                    float w11 = (1 - delta[AXIS1]) * (1 - delta[AXIS2]) / voxvol;
-
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[0]))
-                        w00 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[1 << AXIS1]))
-                        w01 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[1 << AXIS2]))
-                        w10 = 0;
-                    if (!CHECK_CELL_VALID(WEIGHT_RAW, cells[1 << AXIS1 | 1 << AXIS2]))
-                        w11 = 0;
-
-                    const float sum = w00 + w01 + w10 + w11;
-                    if (sum > 0)
+                    for (exint idx = r.begin(); idx < r.end(); ++idx)
                     {
-                        if (w00 > 0)
-                        {
-                            const float weight = w00 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[0], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[0]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[0], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[0]) + weight * vel[AXIS]);
-                        }
-                        if (w01 > 0)
+                        const UT_Vector3I face = TO_3D_IDX(idx, face_res);
+                        bool empty = true, interior = false;
+                        for (const int DIR : {0, 1})
                         {
-                            const float weight = w01 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[1 << AXIS1], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[1 << AXIS1]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[1 << AXIS1], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[1 << AXIS1]) + weight * vel[AXIS]);
-                        }
-                        if (w10 > 0)
-                        {
-                            const float weight = w10 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[1 << AXIS2], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[1 << AXIS2]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[1 << AXIS2], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[1 << AXIS2]) + weight * vel[AXIS]);
-                        }
-                        if (w11 > 0)
-                        {
-                            const float weight = w11 / sum;
-                            SIM::FieldUtils::setFieldValue(*WEIGHT_RAW, cells[1 << AXIS1 | 1 << AXIS2], SIM::FieldUtils::getFieldValue(*WEIGHT_RAW, cells[1 << AXIS1 | 1 << AXIS2]) + weight);
-                            SIM::FieldUtils::setFieldValue(*FLOW->getField(AXIS), cells[1 << AXIS1 | 1 << AXIS2], SIM::FieldUtils::getFieldValue(*FLOW->getField(AXIS), cells[1 << AXIS1 | 1 << AXIS2]) + weight * vel[AXIS]);
+                            const UT_Vector3I cell = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR);
+                            if (cell[AXIS] < 0 || cell[AXIS] >= res[AXIS])
+                                continue;
+                            const exint k = TO_1D_IDX(cell, res);
+                            empty &= !has_particles(k);
+                            interior |= phi[k] < 0;
                         }
+                        if (!empty || !interior)
+                            continue;
+                        const UT_Vector3 pos = FIELD->indexToPos(face);
+                        data[idx] = FLOW_OLD[AXIS].Sample(pos - dt * velocity(pos));
                     }
-                }
-                else
-                    throw std::runtime_error("Invalid dimension");
+                });
+                KnStoreFlatField(FIELD, data);
             }
 
-            if (!WEIGHT)
-                delete WEIGHT_RAW;
-        }
+        if (has_history)
+            for (const int AXIS : axes)
+                FLOW_OLD[AXIS].data.swap(pool.flow_post[AXIS]);
+
+        // Marker and Level Set, the interior keeps distance depth + 1 where the BFS stops
+        std::vector<int> distance(cells);
+        std::vector<unsigned char> fluid(cells);
+        UTparallelFor(UT_BlockedRange<exint>(0, cells), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint k = r.begin(); k < r.end(); ++k)
+            {
+                fluid[k] = has_particles(k) || phi[k] < 0;
+                distance[k] = fluid[k] ? -1 : 0;
+            }
+        });
+        KnStoreFluidCells(MARKER, fluid);
+        RasterizeSolid(MARKER, COLLISION);
+
+        const int depth = band_width + 2;
+        BFS_LAYERS(res, distance, depth, [](int, const std::vector<exint>&) {});
+        pool.level_set.resize(cells);
+        UTparallelFor(UT_BlockedRange<exint>(0, cells), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint k = r.begin(); k < r.end(); ++k)
+                pool.level_set[k] = fluid[k] ? -static_cast<float>(distance[k] < 0 ? depth + 1 : distance[k]) : 1.f;
+        });
     }
 
-    static void Extrapolate(SIM_VectorField* FLOW, const SIM_IndexField* MARKER, SIM_IndexField* EX_INDEX, const int distance)
+    static double* STAT(const HinaFlow::FLIP::Result& result, double HinaFlow::FLIP::Stats::* stage) { return result.STATS ? &(result.STATS->*stage) : nullptr; }
+
+    /**
+    * Moves a particle found inside the collision SDF back onto its surface along the SDF gradient,
+    * and removes the velocity component pointing into the solid.
+    */
+    static void PushOut(UT_Vector3& pos, UT_Vector3& vel, const FlatField& SDF)
     {
-        SIM_RawIndexField* EX_INDEX_RAW = nullptr;
-        if (EX_INDEX)
-            EX_INDEX_RAW = EX_INDEX->getField();
-        else
-            EX_INDEX_RAW = new SIM_RawIndexField(*MARKER->getField());
-        EX_INDEX_RAW->makeConstant(114514);
-        for (int layer = 0; layer <= distance; ++layer)
+        const float phi = SDF.Sample(pos);
+        if (phi >= 0)
+            return;
+
+        UT_Vector3 normal;
+        for (int AXIS : {0, 1, 2})
         {
-            SIM_RawIndexField TEMP(*EX_INDEX_RAW);
-            KnBuildExtrapolateIndex(EX_INDEX_RAW, &TEMP, MARKER, layer);
+            UT_Vector3 offset(0, 0, 0);
+            offset[AXIS] = 0.5f / SDF.inv_dx[AXIS];
+            normal[AXIS] = SDF.Sample(pos + offset) - SDF.Sample(pos - offset);
         }
-        for (const int AXIS : GET_AXIS_ITER(FLOW))
+        if (normal.length2() == 0)
+            return;
+        normal.normalize();
+
+        pos -= phi * normal;
+        if (const float vn = vel.dot(normal); vn < 0)
+            vel -= vn * normal;
+    }
+
+    /**
+    * Deterministic jitter in [0, 1) from a cell, a particle slot and an axis (splitmix64 finalizer).
+    */
+    static float JITTER(const exint cell, const exint slot, const int AXIS)
+    {
+        std::uint64_t h = HASH_COMBINE(HASH_COMBINE(static_cast<std::uint64_t>(cell), static_cast<std::uint64_t>(slot)), static_cast<std::uint64_t>(AXIS));
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return static_cast<float>(h >> 40) / static_cast<float>(1 << 24);
+    }
+}
+
+float HinaFlow::FLIP::MaxSpeed(const Particles& particles)
+{
+    // Max Reduction, one partial result per block
+    constexpr exint BLOCK = 4096;
+    const exint n = static_cast<exint>(particles.vel.size());
+    std::vector<float> partial((n + BLOCK - 1) / BLOCK, 0.f);
+    UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(partial.size())), [&](const UT_BlockedRange<exint>& r)
+    {
+        for (exint b = r.begin(); b < r.end(); ++b)
         {
-            for (int layer = 1; layer < distance; ++layer)
-                KnExtrapolate(FLOW->getField(AXIS), EX_INDEX_RAW, layer, AXIS);
+            float max2 = 0;
+            for (exint i = b * BLOCK; i < std::min(n, (b + 1) * BLOCK); ++i)
+                max2 = std::max(max2, particles.vel[i].length2());
+            partial[b] = max2;
         }
-        if (!EX_INDEX)
-            delete EX_INDEX_RAW;
+    });
+    float max2 = 0;
+    for (const float p : partial)
+        max2 = std::max(max2, p);
+    return std::sqrt(max2);
+}
+
+void HinaFlow::FLIP::LoadParticles(const Input& input, const Param& param, Particles& particles)
+{
+    GU_Detail& gdp = *input.gdp;
+    POINT_ATTRIBUTE_V3(v)
+
+    const SIM_RawIndexField* CELLS = input.MARKER->getField();
+    const UT_Vector3I res = CELLS->getVoxelRes();
+    const UT_Vector3 origin = CELLS->indexToPos(UT_Vector3I(0, 0, 0));
+    const UT_Vector3 dx = CELLS->getVoxelSize();
+
+    const exint n = gdp.getNumPoints();
+    const bool apic = param.transfer == Param::Transfer::APIC;
+    particles.pos.resize(n);
+    particles.vel.resize(n);
+    particles.cell.resize(n);
+    for (auto& affine : particles.affine)
+        affine.resize(apic ? n : 0);
+
+    GA_RWHandleV3 c_handles[3];
+    if (apic)
+    {
+        POINT_ATTRIBUTE_V3(cx)
+        POINT_ATTRIBUTE_V3(cy)
+        POINT_ATTRIBUTE_V3(cz)
+        c_handles[0] = cx_handle;
+        c_handles[1] = cy_handle;
+        c_handles[2] = cz_handle;
+    }
+
+    // Page aligned offset blocks, offsets are mapped to the dense index inside the loop
+    UTparallelFor(GA_SplittableRange(gdp.getPointRange()), [&](const GA_SplittableRange& r)
+    {
+        GA_Offset start, end;
+        for (GA_Iterator it(r); it.blockAdvance(start, end);)
+            for (GA_Offset pt_off = start; pt_off < end; ++pt_off)
+            {
+                const GA_Index i = gdp.pointIndex(pt_off);
+                particles.pos[i] = gdp.getPos3(pt_off);
+                particles.vel[i] = v_handle.get(pt_off);
+                particles.cell[i] = Internal::FLIP::CELL_INDEX(particles.pos[i], res, origin, dx);
+                if (apic)
+                    for (int AXIS : {0, 1, 2})
+                        particles.affine[AXIS][i] = c_handles[AXIS].get(pt_off);
+            }
+    });
+}
+
+void HinaFlow::FLIP::StoreParticles(const Input& input, const Param& param, const Particles& particles)
+{
+    GU_Detail& gdp = *input.gdp;
+    POINT_ATTRIBUTE_V3(v)
+    GA_RWHandleV3 P_handle = gdp.getP();
+
+    const bool apic = param.transfer == Param::Transfer::APIC && particles.affine[0].size() == particles.pos.size();
+    GA_RWHandleV3 c_handles[3];
+    if (apic)
+    {
+        POINT_ATTRIBUTE_V3(cx)
+        POINT_ATTRIBUTE_V3(cy)
+        POINT_ATTRIBUTE_V3(cz)
+        c_handles[0] = cx_handle;
+        c_handles[1] = cy_handle;
+        c_handles[2] = cz_handle;
     }
+
+    // Page aligned offset blocks, so no two threads write (or harden) the same attribute page
+    UTparallelFor(GA_SplittableRange(gdp.getPointRange()), [&](const GA_SplittableRange& r)
+    {
+        GA_Offset start, end;
+        for (GA_Iterator it(r); it.blockAdvance(start, end);)
+            for (GA_Offset pt_off = start; pt_off < end; ++pt_off)
+            {
+                const GA_Index i = gdp.pointIndex(pt_off);
+                if (i >= static_cast<GA_Index>(particles.pos.size()))
+                    continue;
+                P_handle.set(pt_off, particles.pos[i]);
+                v_handle.set(pt_off, particles.vel[i]);
+                if (apic)
+                    for (int AXIS : {0, 1, 2})
+                        c_handles[AXIS].set(pt_off, particles.affine[AXIS][i]);
+            }
+    });
 }
 
 void HinaFlow::FLIP::P2G(const Input& input, const Param& param, Result& result)
 {
-    for (const int i : GET_AXIS_ITER(input.FLOW))
-        FLOW_CACHE[i] = SIM_RawField(*input.FLOW->getField(i));
-    Internal::FLIP::BuildWeight(result.WEIGHT, input.FLOW, input.gdp);
-    Internal::FLIP::BuildMarker(input.MARKER, input.gdp);
-    Internal::FLIP::Extrapolate(input.FLOW, input.MARKER, result.EX_INDEX, param.extrapolate_depth);
+    Particles local;
+    if (!input.PARTICLES)
+        LoadParticles(input, param, local);
+    const Particles& particles = input.PARTICLES ? *input.PARTICLES : local;
+
+    Internal::FLIP::ParticleBins bins;
+    {
+        ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::bins));
+        Internal::FLIP::BuildParticleBins(bins, input.MARKER->getField(), particles);
+    }
+    {
+        ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::weight));
+        Internal::FLIP::BuildWeight(result.WEIGHT, input.FLOW, bins);
+    }
+    FieldPool local_pool;
+    FieldPool& pool = input.POOL ? *input.POOL : local_pool;
+    {
+        ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::marker));
+        if (param.band_width > 0)
+            Internal::FLIP::NarrowBand(input.FLOW, input.MARKER, input.COLLISION, pool, bins, input.dt, param.band_width);
+        else
+            Internal::FLIP::BuildMarker(input.MARKER, bins, input.COLLISION);
+    }
+    {
+        ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::extrapolate));
+        Internal::FLIP::Extrapolate(input.FLOW, input.MARKER, result.EX_INDEX, param.extrapolate_depth);
+    }
+
+    // Pre-projection velocity for the FLIP increment, copied into the reused pool buffers
+    if (param.transfer == Param::Transfer::APIC)
+        return;
+    ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::weight));
+    for (const int AXIS : GET_AXIS_ITER(input.FLOW))
+    {
+        pool.flow_pre[AXIS].resize(input.FLOW->getField(AXIS)->field()->numVoxels());
+        Internal::FLIP::KnLoadFlatField(pool.flow_pre[AXIS], input.FLOW->getField(AXIS));
+    }
 }
 
+/**
+* Projects with the MARKER left by P2G (particle or narrow band cells, solids already rasterized),
+* rebuilding it from the velocity would drop resting liquid and keep extrapolated air as fluid.
+*/
 void HinaFlow::FLIP::SolvePressure(const Input& input, const Param& param, Result& result)
 {
-    Internal::FLIP::BuildMarker(input.MARKER, input.FLOW);
+    ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::pressure));
     input.FLOW->enforceBoundary();
     Poisson::Input I{input.FLOW, input.MARKER};
     Poisson::Param P;
     Poisson::Result R{input.FLOW, result.PRESSURE, result.DIVERGENCE};
     Poisson::SolveMultiThreaded(I, P, R);
     input.FLOW->enforceBoundary();
+    if (result.STATS)
+    {
+        result.STATS->iterations += R.iterations;
+        result.STATS->residual = std::max(result.STATS->residual, static_cast<double>(R.residual));
+    }
 }
 
 void HinaFlow::FLIP::G2P(const Input& input, const Param& param, Result& result)
 {
-    Internal::FLIP::Extrapolate(input.FLOW, input.MARKER, result.EX_INDEX, param.extrapolate_depth);
+    {
+        ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::extrapolate));
+        Internal::FLIP::Extrapolate(input.FLOW, input.MARKER, result.EX_INDEX, param.extrapolate_depth);
+    }
+    ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::g2p));
+
+    Particles local;
+    if (!input.PARTICLES)
+        LoadParticles(input, param, local);
+    Particles& particles = input.PARTICLES ? *input.PARTICLES : local;
+
+    // Flat new velocity and FLIP increment (new - old) per face grid, in the pool buffers (swapped in, not copied)
+    FieldPool local_pool;
+    FieldPool& pool = input.POOL ? *input.POOL : local_pool;
+    const std::vector<int> axes = GET_AXIS_ITER(input.FLOW);
+    const bool apic = param.transfer == Param::Transfer::APIC && particles.affine[0].size() == particles.pos.size();
+    std::array<Internal::FLIP::FlatField, 3> FLOW_NEW, FLOW_DELTA;
+    for (const int AXIS : axes)
+    {
+        FLOW_NEW[AXIS].data.swap(pool.flow_post[AXIS]);
+        FLOW_DELTA[AXIS].data.swap(pool.flow_pre[AXIS]);
+        Internal::FLIP::LoadFlatField(FLOW_NEW[AXIS], input.FLOW->getField(AXIS));
+        if (apic)
+            continue;
+        Internal::FLIP::DescribeFlatField(FLOW_DELTA[AXIS], input.FLOW->getField(AXIS));
+        std::vector<float>& delta = FLOW_DELTA[AXIS].data;
+        const std::vector<float>& v = FLOW_NEW[AXIS].data;
+        if (delta.size() != v.size()) // no matching P2G snapshot, the increment is zero
+            delta = v;
+        UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(delta.size())), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint i = r.begin(); i < r.end(); ++i)
+                delta[i] = v[i] - delta[i];
+        });
+    }
+
+    // PIC/FLIP Blend, or APIC: PIC velocity plus the velocity gradient as affine rows
+    UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(particles.pos.size())), [&](const UT_BlockedRange<exint>& r)
+    {
+        for (exint i = r.begin(); i < r.end(); ++i)
+        {
+            const UT_Vector3 pos = particles.pos[i];
+            UT_Vector3& vel = particles.vel[i];
+            if (apic)
+            {
+                for (const int AXIS : axes)
+                {
+                    vel[AXIS] = FLOW_NEW[AXIS].Sample(pos);
+                    particles.affine[AXIS][i] = FLOW_NEW[AXIS].Gradient(pos);
+                }
+                continue;
+            }
+            for (const int AXIS : axes)
+            {
+                const float v = FLOW_NEW[AXIS].Sample(pos);
+                const float delta = FLOW_DELTA[AXIS].Sample(pos);
+                vel[AXIS] = param.ratio * (vel[AXIS] + delta) + (1 - param.ratio) * v;
+            }
+        }
+    });
+
+    for (const int AXIS : axes)
+    {
+        FLOW_NEW[AXIS].data.swap(pool.flow_post[AXIS]);
+        FLOW_DELTA[AXIS].data.swap(pool.flow_pre[AXIS]);
+    }
+
+    if (!input.PARTICLES)
+        StoreParticles(input, param, local);
+}
+
+void HinaFlow::FLIP::Advect(const Input& input, const Param& param, Result& result)
+{
+    ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::advect));
+    Particles local;
+    if (!input.PARTICLES)
+        LoadParticles(input, param, local);
+    Particles& particles = input.PARTICLES ? *input.PARTICLES : local;
+
+    // Flat divergence-free velocity, in the pool buffers (swapped in, not copied)
+    FieldPool local_pool;
+    FieldPool& pool = input.POOL ? *input.POOL : local_pool;
+    const std::vector<int> axes = GET_AXIS_ITER(input.FLOW);
+    std::array<Internal::FLIP::FlatField, 3> FLOW;
+    for (const int AXIS : axes)
+    {
+        FLOW[AXIS].data.swap(pool.flow_post[AXIS]);
+        Internal::FLIP::LoadFlatField(FLOW[AXIS], input.FLOW->getField(AXIS));
+    }
+    Internal::FLIP::FlatField SDF;
+    if (input.COLLISION)
+        Internal::FLIP::LoadFlatField(SDF, input.COLLISION->getField());
+
+    auto velocity = [&](const UT_Vector3& pos)
+    {
+        UT_Vector3 vel(0, 0, 0);
+        for (const int AXIS : axes)
+            vel[AXIS] = FLOW[AXIS].Sample(pos);
+        return vel;
+    };
+
+    const SIM_RawIndexField* CELLS = input.MARKER->getField();
+    const UT_Vector3I res = CELLS->getVoxelRes();
+    const UT_Vector3 origin = CELLS->indexToPos(UT_Vector3I(0, 0, 0));
+    const UT_Vector3 dx = CELLS->getVoxelSize();
+    const float dt = input.dt;
+
+    UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(particles.pos.size())), [&](const UT_BlockedRange<exint>& r)
+    {
+        for (exint i = r.begin(); i < r.end(); ++i)
+        {
+            UT_Vector3& pos = particles.pos[i];
+            const UT_Vector3 k1 = velocity(pos);
+            if (param.advect_order >= 3)
+            {
+                const UT_Vector3 k2 = velocity(pos + 0.5f * dt * k1);
+                const UT_Vector3 k3 = velocity(pos + 0.75f * dt * k2);
+                pos += dt * (2.f / 9.f * k1 + 3.f / 9.f * k2 + 4.f / 9.f * k3);
+            }
+            else
+                pos += dt * velocity(pos + 0.5f * dt * k1);
+
+            if (input.COLLISION)
+                Internal::FLIP::PushOut(pos, particles.vel[i], SDF);
+            particles.cell[i] = Internal::FLIP::CELL_INDEX(pos, res, origin, dx);
+        }
+    });
+
+    for (const int AXIS : axes)
+        FLOW[AXIS].data.swap(pool.flow_post[AXIS]);
+
+    if (!input.PARTICLES)
+        StoreParticles(input, param, local);
+}
+
+void HinaFlow::FLIP::Reseed(const Input& input, const Param& param, Result& result)
+{
+    if (param.ppc <= 0 && param.band_width <= 0)
+        return;
+    ScopedTimer timer(Internal::FLIP::STAT(result, &Stats::reseed));
+
+    Particles local;
+    if (!input.PARTICLES)
+        LoadParticles(input, param, local);
+    Particles& particles = input.PARTICLES ? *input.PARTICLES : local;
+    FieldPool local_pool;
+    FieldPool& pool = input.POOL ? *input.POOL : local_pool;
+
+    Internal::FLIP::ParticleBins bins;
+    Internal::FLIP::BuildParticleBins(bins, input.MARKER->getField(), particles);
+    const UT_Vector3I res = bins.res;
+    const std::vector<int> axes = GET_AXIS_ITER(input.FLOW);
+    auto count = [&](const exint k) { return bins.start[k + 1] - bins.start[k]; };
+
+    // Narrow band: the level set marks liquid cells without particles, and cells deeper than the band lose theirs
+    const bool band = param.band_width > 0 && pool.level_set.size() == bins.start.size() - 1;
+    auto liquid = [&](const exint k) { return band ? pool.level_set[k] < 0 : count(k) > 0; };
+
+    // Cull and Spawn Lists, per z slice to keep the order deterministic.
+    // Only interior cells (no empty neighbour) are touched, so the surface does not gain or lose volume.
+    const exint cull_above = param.ppc + param.ppc / 2, spawn_below = std::max(param.ppc / 2, 1);
+    std::vector<std::vector<exint>> culls(res.z());
+    std::vector<std::vector<UT_Vector3>> spawns(res.z());
+    std::vector<std::vector<exint>> donors(res.z()); // particle whose attributes a spawned one inherits, -1 for none
+    UTparallelFor(UT_BlockedRange<exint>(0, res.z()), [&](const UT_BlockedRange<exint>& r)
+    {
+        for (exint z = r.begin(); z < r.end(); ++z)
+        {
+            const exint begin = z * res.x() * res.y(), end = begin + res.x() * res.y();
+            for (exint k = begin; k < end; ++k)
+            {
+                const exint n = count(k);
+                if (band && pool.level_set[k] < -static_cast<float>(param.band_width))
+                {
+                    for (exint p = bins.start[k]; p < bins.start[k + 1]; ++p)
+                        culls[z].push_back(bins.index[p]);
+                    continue;
+                }
+                if (param.ppc <= 0 || !liquid(k) || (n <= cull_above && n >= spawn_below))
+                    continue;
+                bool interior = true;
+                Internal::FLIP::FOR_EACH_NEIGHBOUR(res, k, [&](const exint nb) { interior &= liquid(nb); });
+                if (!interior)
+                    continue;
+
+                if (n > cull_above)
+                    for (exint p = bins.start[k] + param.ppc; p < bins.start[k + 1]; ++p)
+                        culls[z].push_back(bins.index[p]);
+                else
+                {
+                    const UT_Vector3I cell = TO_3D_IDX(k, res);
+                    exint donor = n > 0 ? bins.index[bins.start[k]] : -1;
+                    Internal::FLIP::FOR_EACH_NEIGHBOUR(res, k, [&](const exint nb) { if (donor < 0 && count(nb) > 0) donor = bins.index[bins.start[nb]]; });
+                    for (exint slot = n; slot < param.ppc; ++slot)
+                    {
+                        UT_Vector3 pos = bins.origin;
+                        for (const int AXIS : axes)
+                            pos[AXIS] += (static_cast<float>(cell[AXIS]) + Internal::FLIP::JITTER(k, slot, AXIS) - 0.5f) * bins.dx[AXIS];
+                        spawns[z].push_back(pos);
+                        donors[z].push_back(donor);
+                    }
+                }
+            }
+        }
+    });
+
+    std::vector<unsigned char> dead(particles.pos.size(), 0);
+    std::vector<UT_Vector3> born;
+    std::vector<exint> born_donor;
+    for (exint z = 0; z < res.z(); ++z)
+    {
+        for (const exint i : culls[z])
+            dead[i] = 1;
+        born.insert(born.end(), spawns[z].begin(), spawns[z].end());
+        born_donor.insert(born_donor.end(), donors[z].begin(), donors[z].end());
+    }
+    if (born.empty() && std::find(dead.begin(), dead.end(), 1) == dead.end())
+        return;
 
+    // Detail: new points are appended and inherit every attribute of their donor (P and v are stored later),
+    // with fresh ids when the particles carry an id. Culled points are then destroyed in one pass, together with
+    // any primitive they leave degenerate, which keeps the index order of the survivors and the new points intact.
     GU_Detail& gdp = *input.gdp;
-    POINT_ATTRIBUTE_V3(v)
-    GA_Offset pt_off;
-    GA_FOR_ALL_PTOFF(input.gdp, pt_off)
-    {
-        const UT_Vector3 pos = gdp.getPos3(pt_off);
-        UT_Vector3 v = input.FLOW->getValue(pos);
-        UT_Vector3 delta = v - UT_Vector3F{
-            static_cast<float>(FLOW_CACHE[0].getValue(pos)),
-            static_cast<float>(FLOW_CACHE[1].getValue(pos)),
-            static_cast<float>(FLOW_CACHE[2].getValue(pos))
-        };
-        UT_Vector3 vel = v_handle.get(pt_off);
-        vel = param.ratio * (vel + delta) + (1 - param.ratio) * v;
+    GA_OffsetList culled;
+    for (exint i = 0; i < static_cast<exint>(dead.size()); ++i)
+        if (dead[i])
+            culled.append(gdp.pointOffset(i));
+    if (!born.empty())
+    {
+        const GA_Offset first = gdp.appendPointBlock(static_cast<GA_Size>(born.size()));
+        for (exint i = 0; i < static_cast<exint>(born.size()); ++i)
+            if (born_donor[i] >= 0)
+                gdp.copyPointAttributeValues(first + i, gdp.pointOffset(born_donor[i]));
+
+        GA_RWHandleI id_handle(gdp.findPointAttribute("id"));
+        if (id_handle.isValid())
+        {
+            int next_id = 0;
+            for (exint i = 0; i < static_cast<exint>(dead.size()); ++i)
+                next_id = std::max(next_id, id_handle.get(gdp.pointOffset(i)) + 1);
+            for (exint i = 0; i < static_cast<exint>(born.size()); ++i)
+                id_handle.set(first + i, next_id++);
+        }
     }
+    if (culled.entries() > 0)
+        gdp.destroyPoints(GA_Range(gdp.getPointMap(), culled), GA_DESTROY_DEGENERATE);
+
+    // Snapshot: the same compaction, new particles take the grid velocity
+    exint alive = 0;
+    for (exint i = 0; i < static_cast<exint>(dead.size()); ++i)
+        if (!dead[i])
+        {
+            particles.pos[alive] = particles.pos[i];
+            particles.vel[alive] = particles.vel[i];
+            particles.cell[alive] = particles.cell[i];
+            for (auto& affine : particles.affine)
+                if (!affine.empty())
+                    affine[alive] = affine[i];
+            ++alive;
+        }
+    particles.pos.resize(alive + born.size());
+    particles.vel.resize(alive + born.size());
+    particles.cell.resize(alive + born.size());
+    for (auto& affine : particles.affine)
+        if (!affine.empty())
+            affine.resize(alive + born.size());
+
+    std::array<Internal::FLIP::FlatField, 3> FLOW;
+    for (const int AXIS : axes)
+    {
+        FLOW[AXIS].data.swap(pool.flow_post[AXIS]);
+        Internal::FLIP::LoadFlatField(FLOW[AXIS], input.FLOW->getField(AXIS));
+    }
+    UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(born.size())), [&](const UT_BlockedRange<exint>& r)
+    {
+        for (exint i = r.begin(); i < r.end(); ++i)
+        {
+            particles.pos[alive + i] = born[i];
+            particles.vel[alive + i] = UT_Vector3(0, 0, 0);
+            for (const int AXIS : axes)
+                particles.vel[alive + i][AXIS] = FLOW[AXIS].Sample(born[i]);
+            for (const int AXIS : axes)
+                if (!particles.affine[AXIS].empty())
+                    particles.affine[AXIS][alive + i] = FLOW[AXIS].Gradient(born[i]);
+            particles.cell[alive + i] = Internal::FLIP::CELL_INDEX(born[i], res, bins.origin, bins.dx);
+        }
+    });
+    for (const int AXIS : axes)
+        FLOW[AXIS].data.swap(pool.flow_post[AXIS]);
+
+    if (!input.PARTICLES)
+        StoreParticles(input, param, local);
 }
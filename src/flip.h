@@ -17,21 +17,69 @@
 #include <SIM/SIM_VectorField.h>
 #include <SIM/SIM_IndexField.h>
 
+#include <array>
+#include <vector>
+
 namespace HinaFlow
 {
     struct FLIP
     {
+        /**
+        * Structure-of-arrays snapshot of the particles, indexed by point index.
+        * Loaded once per step, used by every stage, and stored back to the detail in one pass.
+        */
+        struct Particles
+        {
+            std::vector<UT_Vector3> pos;
+            std::vector<UT_Vector3> vel;
+            std::vector<exint> cell; // linear MARKER cell index, -1 outside the domain
+            std::array<std::vector<UT_Vector3>, 3> affine; // APIC only: row AXIS of C, the gradient of velocity AXIS (point attributes cx, cy, cz)
+        };
+
+        /**
+        * Flat face buffers reused between steps, reallocated only when the resolution grows.
+        * The caller owns one pool per engine, node and object and never shares it, so concurrent solves do not race on it.
+        * flow_pre holds the velocity right after P2G, flow_post the projected one during G2P.
+        * level_set is the narrow band liquid level set, per MARKER cell, in cells, negative inside the liquid.
+        */
+        struct FieldPool
+        {
+            std::array<std::vector<float>, 3> flow_pre;
+            std::array<std::vector<float>, 3> flow_post;
+            std::vector<float> level_set;
+        };
+
+        /**
+        * Wall time per stage in seconds and the work done, accumulated over every call that receives it.
+        */
+        struct Stats
+        {
+            double load = 0, bins = 0, weight = 0, marker = 0, extrapolate = 0, pressure = 0, g2p = 0, advect = 0, reseed = 0, store = 0;
+            exint particles = 0; // particles transferred, summed over substeps
+            exint voxels = 0; // MARKER voxels projected, summed over substeps
+            exint iterations = 0; // pressure CG iterations, summed over substeps
+            double residual = 0; // largest relative pressure CG residual over substeps
+        };
+
         struct Input
         {
             GU_Detail* gdp = nullptr; // required
             SIM_VectorField* FLOW = nullptr; // required
             SIM_IndexField* MARKER = nullptr; // required
+            Particles* PARTICLES = nullptr; // optional, snapshot shared by all stages, otherwise each stage reads gdp itself
+            FieldPool* POOL = nullptr; // optional, caller owned per engine/node/object, buffers kept across calls, without it the FLIP increment is zero and the narrow band has no history
+            SIM_ScalarField* COLLISION = nullptr; // optional, collision SDF (negative inside), particles are pushed out of it
+            float dt = 0;
         };
 
         struct Param
         {
+            enum class Transfer { FLIP, APIC } transfer = Transfer::FLIP;
             int extrapolate_depth = 6;
-            float ratio = 0.97f;
+            float ratio = 0.97f; // FLIP only
+            int advect_order = 2; // Runge-Kutta order of Advect, 2 (midpoint) or 3 (Ralston)
+            int ppc = 8; // target particles per cell of Reseed
+            int band_width = 0; // narrow band mode: particles are kept only within this many cells of the surface, 0 keeps them everywhere
         };
 
         struct Result // Results
@@ -40,14 +88,18 @@ namespace HinaFlow
             SIM_ScalarField* PRESSURE = nullptr; // required
             SIM_ScalarField* DIVERGENCE = nullptr; // optional
             SIM_IndexField* EX_INDEX = nullptr; // optional
+            Stats* STATS = nullptr; // optional, stage timings
         };
 
 
+        static float MaxSpeed(const Particles& particles);
+        static void LoadParticles(const Input& input, const Param& param, Particles& particles);
+        static void StoreParticles(const Input& input, const Param& param, const Particles& particles);
         static void P2G(const Input& input, const Param& param, Result& result);
         static void SolvePressure(const Input& input, const Param& param, Result& result);
         static void G2P(const Input& input, const Param& param, Result& result);
-
-        static std::array<SIM_RawField, 3> FLOW_CACHE;
+        static void Advect(const Input& input, const Param& param, Result& result);
+        static void Reseed(const Input& input, const Param& param, Result& result);
     };
 }
 
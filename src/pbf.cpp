@@ -16,133 +16,308 @@
 
 static std::vector<UT_Vector3> temp;
 
+namespace HinaFlow::Internal::PBF
+{
+    /**
+    * Uniform grid over the point bounding box with cells of size at least the search radius H, points counting-sorted by cell.
+    * Points of cell k are order[start[k]] .. order[start[k + 1] - 1].
+    */
+    struct CellGrid
+    {
+        UT_Vector3 origin;
+        UT_Vector3I res;
+        float h = 1; // search radius
+        float size = 1; // cell size, h unless far outliers would make the grid much larger than the point count
+        std::vector<exint> key; // cell of each point index
+        std::vector<exint> start;
+        std::vector<exint> order;
+
+        UT_Vector3I CellOf(const UT_Vector3& pos) const
+        {
+            UT_Vector3I cell;
+            for (int AXIS : {0, 1, 2})
+            {
+                const float d = (pos[AXIS] - origin[AXIS]) / size; // clamped before the cast, NaN goes to cell 0
+                cell[AXIS] = d > 0 ? static_cast<exint>(std::min(d, static_cast<float>(res[AXIS] - 1))) : 0;
+            }
+            return cell;
+        }
+    };
+
+    static void BuildCellGrid(CellGrid& grid, const std::vector<UT_Vector3>& pos, const float h)
+    {
+        const exint n = static_cast<exint>(pos.size());
+
+        // Bounding Box of the finite positions, one partial result per block
+        constexpr exint BLOCK = 4096;
+        constexpr float MAX = std::numeric_limits<float>::max();
+        std::vector<UT_Vector3> lo((n + BLOCK - 1) / BLOCK, UT_Vector3(MAX, MAX, MAX)), hi(lo.size(), UT_Vector3(-MAX, -MAX, -MAX));
+        UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(lo.size())), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint b = r.begin(); b < r.end(); ++b)
+                for (exint i = b * BLOCK; i < std::min(n, (b + 1) * BLOCK); ++i)
+                {
+                    if (!std::isfinite(pos[i].x()) || !std::isfinite(pos[i].y()) || !std::isfinite(pos[i].z()))
+                        continue;
+                    for (int AXIS : {0, 1, 2})
+                    {
+                        lo[b][AXIS] = std::min(lo[b][AXIS], pos[i][AXIS]);
+                        hi[b][AXIS] = std::max(hi[b][AXIS], pos[i][AXIS]);
+                    }
+                }
+        });
+        UT_Vector3 box_lo(MAX, MAX, MAX), box_hi(-MAX, -MAX, -MAX);
+        for (size_t b = 0; b < lo.size(); ++b)
+            for (int AXIS : {0, 1, 2})
+            {
+                box_lo[AXIS] = std::min(box_lo[AXIS], lo[b][AXIS]);
+                box_hi[AXIS] = std::max(box_hi[AXIS], hi[b][AXIS]);
+            }
+        if (box_lo.x() > box_hi.x()) // no finite position at all
+            box_lo = box_hi = UT_Vector3(0, 0, 0);
+
+        // Resolution, counted in double so that a huge extent cannot overflow before the cells are enlarged
+        grid.h = h;
+        grid.size = h > 0 ? h : 1.f; // a zero or NaN radius would never stop the doubling below
+        grid.origin = box_lo;
+        for (;;)
+        {
+            double cells = 1;
+            for (int AXIS : {0, 1, 2})
+                cells *= std::floor((static_cast<double>(box_hi[AXIS]) - box_lo[AXIS]) / grid.size) + 1;
+            if (cells <= static_cast<double>(8 * n + 64))
+                break;
+            grid.size *= 2; // larger cells still hold every neighbour within the 27 cells around a point
+        }
+        for (int AXIS : {0, 1, 2})
+            grid.res[AXIS] = static_cast<exint>(std::floor((static_cast<double>(box_hi[AXIS]) - box_lo[AXIS]) / grid.size)) + 1;
+        const exint cells = grid.res.x() * grid.res.y() * grid.res.z();
+
+        // Cell Keys
+        grid.key.resize(n);
+        UTparallelFor(UT_BlockedRange<exint>(0, n), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint i = r.begin(); i < r.end(); ++i)
+                grid.key[i] = TO_1D_IDX(grid.CellOf(pos[i]), grid.res);
+        });
+
+        // Counting Sort, cells keep their points in index order
+        COUNTING_SORT(grid.key, cells, grid.start, grid.order);
+    }
+
+    /**
+    * Visits the points within H of point I (itself included) from the 27 cells around it.
+    */
+    template <typename Visit>
+    void FOR_EACH_NEIGHBOUR(const CellGrid& grid, const std::vector<UT_Vector3>& pos, const exint i, Visit visit)
+    {
+        const UT_Vector3I c = TO_3D_IDX(grid.key[i], grid.res);
+        const float h2 = grid.h * grid.h;
+        for (exint z = std::max<exint>(c.z() - 1, 0); z <= std::min(c.z() + 1, grid.res.z() - 1); ++z)
+            for (exint y = std::max<exint>(c.y() - 1, 0); y <= std::min(c.y() + 1, grid.res.y() - 1); ++y)
+            {
+                // Cells x - 1 .. x + 1 of a row are contiguous in the sorted order
+                const exint row = TO_1D_IDX(UT_Vector3I(0, y, z), grid.res);
+                const exint begin = grid.start[row + std::max<exint>(c.x() - 1, 0)];
+                const exint end = grid.start[row + std::min(c.x() + 1, grid.res.x() - 1) + 1];
+                for (exint p = begin; p < end; ++p)
+                    if (const exint j = grid.order[p]; (pos[j] - pos[i]).length2() <= h2)
+                        visit(j);
+            }
+    }
+}
+
+void HinaFlow::PBF::BuildNeighbours(const Input& input, const Param& param, Neighbours& neighbours)
+{
+    const GU_Detail& gdp = *input.gdp;
+    const exint n = gdp.getNumPoints();
+
+    std::vector<UT_Vector3> pos(n);
+    UTparallelFor(UT_BlockedRange<exint>(0, n), [&](const UT_BlockedRange<exint>& r)
+    {
+        for (exint i = r.begin(); i < r.end(); ++i)
+            pos[i] = gdp.getPos3(gdp.pointOffset(i));
+    });
+
+    neighbours.start.assign(n + 1, 0);
+    neighbours.index.clear();
+    if (n == 0)
+        return;
+
+    Internal::PBF::CellGrid grid;
+    Internal::PBF::BuildCellGrid(grid, pos, param.kernel_radius);
+
+    // CSR: count, prefix sum, then fill, all passes in parallel
+    UTparallelFor(UT_BlockedRange<exint>(0, n), [&](const UT_BlockedRange<exint>& r)
+    {
+        for (exint i = r.begin(); i < r.end(); ++i)
+        {
+            exint count = 0;
+            Internal::PBF::FOR_EACH_NEIGHBOUR(grid, pos, i, [&](exint) { ++count; });
+            neighbours.start[i] = count;
+        }
+    });
+    neighbours.index.resize(PREFIX_SUM(neighbours.start));
+    UTparallelFor(UT_BlockedRange<exint>(0, n), [&](const UT_BlockedRange<exint>& r)
+    {
+        for (exint i = r.begin(); i < r.end(); ++i)
+        {
+            exint slot = neighbours.start[i];
+            Internal::PBF::FOR_EACH_NEIGHBOUR(grid, pos, i, [&](const exint j) { neighbours.index[slot++] = j; });
+        }
+    });
+}
+
 void HinaFlow::PBF::Advect(const Input& input, const Param& param, Result& result)
 {
     GU_Detail& gdp = *input.gdp;
-    GA_Offset i;
     GA_RWHandleV3 p_handle = gdp.getP();
     POINT_ATTRIBUTE_V3(v)
 
+    // Page aligned offset blocks, so no two threads write the same attribute page
     temp.resize(gdp.getNumPoints());
-    GA_FOR_ALL_PTOFF(&gdp, i)
+    UTparallelFor(GA_SplittableRange(gdp.getPointRange()), [&](const GA_SplittableRange& r)
     {
-        temp[gdp.pointIndex(i)] = p_handle.get(i);
-        v_handle.set(i, v_handle.get(i) + UT_Vector3{0.f, param.gravity, 0.f} * input.dt);
-        p_handle.set(i, p_handle.get(i) + v_handle.get(i) * input.dt);
-    }
+        GA_Offset start, end;
+        for (GA_Iterator it(r); it.blockAdvance(start, end);)
+            for (GA_Offset i = start; i < end; ++i)
+            {
+                temp[gdp.pointIndex(i)] = p_handle.get(i);
+                v_handle.set(i, v_handle.get(i) + UT_Vector3{0.f, param.gravity, 0.f} * input.dt);
+                p_handle.set(i, p_handle.get(i) + v_handle.get(i) * input.dt);
+            }
+    });
 }
 
 void HinaFlow::PBF::SolvePressure(const Input& input, const Param& param, Result& result)
 {
     GU_Detail& gdp = *input.gdp;
-    const int64 size = gdp.getNumPoints();
-    GA_Offset i;
     GA_RWHandleV3 p_handle = gdp.getP();
     POINT_ATTRIBUTE_V3(v)
     POINT_ATTRIBUTE_F(mass)
     POINT_ATTRIBUTE_F(lambda)
     POINT_ATTRIBUTE_I(nn)
 
-    auto& Kernel = Poly6;
+    const auto* Kernel = &Poly6;
     if (param.kernel_type == Param::KernelType::Spiky)
-        Kernel = Spiky;
+        Kernel = &Spiky;
     else if (param.kernel_type == Param::KernelType::Cubic)
-        Kernel = Cubic;
-    auto& gradKernel = gradPoly6;
+        Kernel = &Cubic;
+    const auto* gradKernel = &gradPoly6;
     if (param.kernel_type == Param::KernelType::Spiky)
-        gradKernel = gradSpiky;
+        gradKernel = &gradSpiky;
     else if (param.kernel_type == Param::KernelType::Cubic)
-        gradKernel = gradCubic;
+        gradKernel = &gradCubic;
+    const float h = param.kernel_radius;
 
 
-    // Build Neighbors
-    GU_NeighbourList Searcher;
-    GU_NeighbourListParms NLP;
-    NLP.setRadius(param.kernel_radius);
-    NLP.setOverrideRadius(true);
-    NLP.setMode(GU_NeighbourListParms::InteractionMode::UNIFORM);
-    Searcher.build(&gdp, NLP);
-    std::vector<UT_Array<GA_Offset>> neighbors(size);
+    // Neighbours, point indices in CSR form
+    Neighbours local;
+    if (!input.NEIGHBOURS)
+        BuildNeighbours(input, param, local);
+    const Neighbours& neighbours = input.NEIGHBOURS ? *input.NEIGHBOURS : local;
+
+
+    // Flat Buffers, every pass below reads one buffer and writes another, so the result does not depend on the traversal order
+    const exint n = gdp.getNumPoints();
+    std::vector<UT_Vector3> pos(n), deltap(n);
+    std::vector<float> mass(n), lambda(n);
+    UTparallelFor(UT_BlockedRange<exint>(0, n), [&](const UT_BlockedRange<exint>& r)
     {
-        GA_FOR_ALL_PTOFF(&gdp, i)
+        for (exint pi = r.begin(); pi < r.end(); ++pi)
         {
-            Searcher.getNeighbours(static_cast<int>(i), &gdp, neighbors[gdp.pointIndex(i)]);
-            nn_handle.set(i, static_cast<int>(neighbors[gdp.pointIndex(i)].size()));
+            const GA_Offset i = gdp.pointOffset(pi);
+            pos[pi] = p_handle.get(i);
+            mass[pi] = mass_handle.get(i);
         }
-    }
+    });
+    auto density_at = [&](const exint pi)
+    {
+        float density = 0;
+        for (exint k = neighbours.start[pi]; k < neighbours.start[pi + 1]; ++k)
+            density += mass[neighbours.index[k]] * (*Kernel)(pos[pi] - pos[neighbours.index[k]], h);
+        return density;
+    };
 
 
     // Compute lambda
+    UTparallelFor(UT_BlockedRange<exint>(0, n), [&](const UT_BlockedRange<exint>& r)
     {
-        GA_FOR_ALL_PTOFF(&gdp, i)
+        for (exint pi = r.begin(); pi < r.end(); ++pi)
         {
-            float lambda = 0;
-            float density = 0;
-            UT_Vector3 gradi{0.f, 0.f, 0.f};
-            for (GA_Offset j : neighbors[i])
+            const float density = density_at(pi);
+            if (density <= param.rest_density)
             {
-                density += mass_handle.get(j) * Kernel(p_handle.get(i) - p_handle.get(j), param.kernel_radius);
-                if (i == j)
-                    gradi += gradKernel(p_handle.get(i) - p_handle.get(j), param.kernel_radius);
-                else
-                    lambda += gradKernel(p_handle.get(i) - p_handle.get(j), param.kernel_radius).length2();
+                lambda[pi] = 0;
+                continue;
             }
-            if (density > param.rest_density)
+            float sum_grad2 = 0;
+            UT_Vector3 gradi{0.f, 0.f, 0.f};
+            for (exint k = neighbours.start[pi]; k < neighbours.start[pi + 1]; ++k)
             {
-                lambda += gradi.length2();
-                lambda += param.epsilon;
-                lambda = -(density - param.rest_density) / lambda;
+                const exint pj = neighbours.index[k];
+                if (pj == pi)
+                    continue;
+                const UT_Vector3 grad = (*gradKernel)(pos[pi] - pos[pj], h);
+                gradi += grad;
+                sum_grad2 += grad.length2();
             }
-            else
-                lambda = 0;
-            lambda_handle.set(i, lambda);
+            lambda[pi] = -(density - param.rest_density) / (sum_grad2 + gradi.length2() + param.epsilon);
         }
-    }
+    });
 
 
-    // Compute and Apply deltaP
+    // Compute deltaP
+    UTparallelFor(UT_BlockedRange<exint>(0, n), [&](const UT_BlockedRange<exint>& r)
     {
-        GA_FOR_ALL_PTOFF(&gdp, i)
+        for (exint pi = r.begin(); pi < r.end(); ++pi)
         {
-            UT_Vector3 deltap = {0.f, 0.f, 0.f};
-            for (GA_Offset j : neighbors[i])
-                deltap += (lambda_handle.get(i) + lambda_handle.get(j)) * gradKernel(p_handle.get(i) - p_handle.get(j), param.kernel_radius);
-            p_handle.set(i, p_handle.get(i) + param.dpscale * deltap);
+            UT_Vector3 dp = {0.f, 0.f, 0.f};
+            for (exint k = neighbours.start[pi]; k < neighbours.start[pi + 1]; ++k)
+                if (const exint pj = neighbours.index[k]; pj != pi)
+                    dp += (lambda[pi] + lambda[pj]) * (*gradKernel)(pos[pi] - pos[pj], h);
+            deltap[pi] = param.dpscale * dp;
         }
-    }
+    });
 
 
-    // Enforce Boundary
+    // Apply deltaP and Enforce Boundary, over page aligned offset blocks since it writes the detail
+    UTparallelFor(GA_SplittableRange(gdp.getPointRange()), [&](const GA_SplittableRange& r)
     {
-        GA_FOR_ALL_PTOFF(&gdp, i)
-        {
-            UT_Vector3 pos = p_handle.get(i);
-            if (pos.x() > param.HalfBound.x())
-                pos.x() = param.HalfBound.x();
-            if (pos.x() < -param.HalfBound.x())
-                pos.x() = -param.HalfBound.x();
-            if (!param.TopOpen)
-                if (pos.y() > param.HalfBound.y())
-                    pos.y() = param.HalfBound.y();
-            if (pos.y() < -param.HalfBound.y())
-                pos.y() = -param.HalfBound.y();
-            if (pos.z() > param.HalfBound.z())
-                pos.z() = param.HalfBound.z();
-            if (pos.z() < -param.HalfBound.z())
-                pos.z() = -param.HalfBound.z();
-            p_handle.set(i, pos);
-        }
-    }
+        GA_Offset start, end;
+        for (GA_Iterator it(r); it.blockAdvance(start, end);)
+            for (GA_Offset i = start; i < end; ++i)
+            {
+                const exint pi = gdp.pointIndex(i);
+                UT_Vector3 p = pos[pi] + deltap[pi];
+                p.x() = std::clamp(p.x(), -param.HalfBound.x(), param.HalfBound.x());
+                p.y() = param.TopOpen ? std::max(p.y(), -param.HalfBound.y()) : std::clamp(p.y(), -param.HalfBound.y(), param.HalfBound.y());
+                p.z() = std::clamp(p.z(), -param.HalfBound.z(), param.HalfBound.z());
+                pos[pi] = p;
 
+                p_handle.set(i, p);
+                lambda_handle.set(i, lambda[pi]);
+                nn_handle.set(i, static_cast<int>(neighbours.start[pi + 1] - neighbours.start[pi]));
+            }
+    });
+
+
+    // Density Error, one partial sum per block so the total is deterministic
     {
-        float sumC = 0;
-        GA_FOR_ALL_PTOFF(&gdp, i)
+        constexpr exint BLOCK = 4096;
+        std::vector<float> partial((n + BLOCK - 1) / BLOCK, 0.f);
+        UTparallelFor(UT_BlockedRange<exint>(0, static_cast<exint>(partial.size())), [&](const UT_BlockedRange<exint>& r)
         {
-            float density = 0;
-            for (GA_Offset j : neighbors[i])
-                density += mass_handle.get(j) * Kernel(p_handle.get(i) - p_handle.get(j), param.kernel_radius);
-            sumC += density > param.rest_density ? (density / param.rest_density - 1) : 0;
-        }
+            for (exint b = r.begin(); b < r.end(); ++b)
+                for (exint pi = b * BLOCK; pi < std::min(n, (b + 1) * BLOCK); ++pi)
+                {
+                    const float density = density_at(pi);
+                    partial[b] += density > param.rest_density ? (density / param.rest_density - 1) : 0;
+                }
+        });
+        float sumC = 0;
+        for (const float c : partial)
+            sumC += c;
         if (sumC < 1)
         {
             result.done = true;
@@ -154,12 +329,14 @@ void HinaFlow::PBF::SolvePressure(const Input& input, const Param& param, Result
 void HinaFlow::PBF::UpdateVelocity(const Input& input, const Param& param, Result& result)
 {
     GU_Detail& gdp = *input.gdp;
-    GA_Offset i;
     GA_RWHandleV3 p_handle = gdp.getP();
     POINT_ATTRIBUTE_V3(v)
 
-    GA_FOR_ALL_PTOFF(&gdp, i)
+    UTparallelFor(GA_SplittableRange(gdp.getPointRange()), [&](const GA_SplittableRange& r)
     {
-        v_handle.set(i, (p_handle.get(i) - temp[gdp.pointIndex(i)]) / input.dt * (1 - param.viscosity));
-    }
+        GA_Offset start, end;
+        for (GA_Iterator it(r); it.blockAdvance(start, end);)
+            for (GA_Offset i = start; i < end; ++i)
+                v_handle.set(i, (p_handle.get(i) - temp[gdp.pointIndex(i)]) / input.dt * (1 - param.viscosity));
+    });
 }
@@ -15,14 +15,27 @@
 
 #include <GU/GU_Detail.h>
 
+#include <vector>
+
 namespace HinaFlow
 {
     struct PBF
     {
+        /**
+        * Neighbours within kernel_radius of every point (itself included), as a flat CSR list of point indices.
+        * The neighbours of point index i are index[start[i]] .. index[start[i + 1] - 1].
+        */
+        struct Neighbours
+        {
+            std::vector<exint> start;
+            std::vector<exint> index;
+        };
+
         struct Input
         {
             GU_Detail* gdp = nullptr; // required
             float dt = 1.f; // required
+            Neighbours* NEIGHBOURS = nullptr; // optional, built once per step and shared by every SolvePressure call, otherwise each call builds its own
         };
 
         struct Param
@@ -50,6 +63,7 @@ namespace HinaFlow
             bool done = false;
         };
 
+        static void BuildNeighbours(const Input& input, const Param& param, Neighbours& neighbours);
         static void Advect(const Input& input, const Param& param, Result& result);
         static void SolvePressure(const Input& input, const Param& param, Result& result);
         static void UpdateVelocity(const Input& input, const Param& param, Result& result);
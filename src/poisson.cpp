@@ -40,7 +40,7 @@ void HinaFlow::Poisson::Solve(const Input& input, const Param& param, Result& re
                     UT_Vector3I cell0 = SIM::FieldUtils::cellToCellMap(cell, AXIS, DIR);
                     int idx0 = static_cast<int>(TO_1D_IDX(cell0, res));
 
-                    if (CHECK_CELL_VALID(input.MARKER->getField(), cell0))
+                    if (CHECK_CELL_VALID(input.MARKER->getField(), cell0) && !CHECK_CELL_TYPE<CellType::Solid>(input.MARKER, cell0)) // solids are Neumann walls
                     {
                         A.addToElement(idx, idx, 1.0f);
                         A.addToElement(idx, idx0, -1.0f);
@@ -56,6 +56,21 @@ void HinaFlow::Poisson::Solve(const Input& input, const Param& param, Result& re
 
 
     // Build b (Store Divergence Optional)
+    for (const int AXIS : GET_AXIS_ITER(input.FLOW))
+    {
+        UT_VoxelArrayIteratorF vit;
+        vit.setArray(input.FLOW->getField(AXIS)->fieldNC());
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+        {
+            const UT_Vector3I face(vit.x(), vit.y(), vit.z());
+            constexpr int DIR_0 = 0, DIR_1 = 1;
+            const UT_Vector3I cell0 = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR_0);
+            const UT_Vector3I cell1 = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR_1);
+            if ((CHECK_CELL_VALID(input.MARKER->getField(), cell0) && CHECK_CELL_TYPE<CellType::Solid>(input.MARKER, cell0)) ||
+                (CHECK_CELL_VALID(input.MARKER->getField(), cell1) && CHECK_CELL_TYPE<CellType::Solid>(input.MARKER, cell1)))
+                vit.setValue(0); // static solid
+        }
+    }
     UT_VectorF b(0, size - 1);
     {
         UT_VoxelArrayIteratorI vit;
@@ -88,7 +103,7 @@ void HinaFlow::Poisson::Solve(const Input& input, const Param& param, Result& re
 
     // Solve System
     x = b;
-    AImpl.solveConjugateGradient(x, b, nullptr);
+    result.residual = AImpl.solveConjugateGradient(x, b, nullptr, 1e-5f, -1, &result.iterations);
 
 
     // Store Pressure
@@ -115,6 +130,12 @@ void HinaFlow::Poisson::Solve(const Input& input, const Param& param, Result& re
             constexpr int DIR_0 = 0, DIR_1 = 1;
             const UT_Vector3I cell0 = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR_0);
             const UT_Vector3I cell1 = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR_1);
+            if ((CHECK_CELL_VALID(input.MARKER->getField(), cell0) && CHECK_CELL_TYPE<CellType::Solid>(input.MARKER, cell0)) ||
+                (CHECK_CELL_VALID(input.MARKER->getField(), cell1) && CHECK_CELL_TYPE<CellType::Solid>(input.MARKER, cell1)))
+            {
+                vit.setValue(0); // static solid
+                continue;
+            }
             // This will clamp the bounds to fit within the voxel array, using the border type to resolve out of range values.
             const fpreal32 p0 = result.PRESSURE->getField()->field()->getValue(static_cast<int>(cell0.x()), static_cast<int>(cell0.y()), static_cast<int>(cell0.z()));
             // This will clamp the bounds to fit within the voxel array, using the border type to resolve out of range values.
@@ -152,7 +173,7 @@ namespace HinaFlow::Internal::Poisson
                     UT_Vector3I cell0 = SIM::FieldUtils::cellToCellMap(cell, AXIS, DIR);
                     const int idx0 = static_cast<int>(TO_1D_IDX(cell0, res));
 
-                    if (CHECK_CELL_VALID(MARKER->getField(), cell0))
+                    if (CHECK_CELL_VALID(MARKER->getField(), cell0) && !CHECK_CELL_TYPE<CellType::Solid>(MARKER, cell0)) // solids are Neumann walls
                     {
                         A.addToElement(idx, idx, 1.0f);
                         A.addToElement(idx, idx0, -1.0f);
@@ -165,6 +186,31 @@ namespace HinaFlow::Internal::Poisson
     THREADED_METHOD2(, false /* DO NOT USE MULTI THREAD HERE */, KnBuildLaplaceMatrix, UT_SparseMatrixF&, A, const SIM_IndexField*, MARKER);
 
 
+    /**
+    * Zeroes the AXIS faces touching a solid cell, so the right hand side sees no flux through static solids
+    * and the projected divergence matches the Laplacian, which has no solid neighbours.
+    */
+    void KnZeroSolidFacesPartial(SIM_VectorField* FLOW, const SIM_IndexField* MARKER, const int AXIS, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorF vit;
+        vit.setArray(FLOW->getField(AXIS)->fieldNC());
+        vit.setCompressOnExit(true);
+        vit.setPartialRange(info.job(), info.numJobs());
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+        {
+            const UT_Vector3I face(vit.x(), vit.y(), vit.z());
+            constexpr int DIR_0 = 0, DIR_1 = 1;
+            const UT_Vector3I cell0 = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR_0);
+            const UT_Vector3I cell1 = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR_1);
+            if ((CHECK_CELL_VALID(MARKER->getField(), cell0) && CHECK_CELL_TYPE<CellType::Solid>(MARKER, cell0)) ||
+                (CHECK_CELL_VALID(MARKER->getField(), cell1) && CHECK_CELL_TYPE<CellType::Solid>(MARKER, cell1)))
+                vit.setValue(0); // static solid
+        }
+    }
+
+    THREADED_METHOD3(, FLOW->getField(AXIS)->shouldMultiThread(), KnZeroSolidFaces, SIM_VectorField*, FLOW, const SIM_IndexField*, MARKER, const int, AXIS);
+
     void KnBuildRhsPartial(UT_VectorF& b, const SIM_VectorField* FLOW, const SIM_IndexField* MARKER, SIM_ScalarField* DIVERGENCE, const UT_JobInfo& info)
     {
         UT_VoxelArrayIteratorI vit;
@@ -221,7 +267,7 @@ namespace HinaFlow::Internal::Poisson
 
     THREADED_METHOD2(, PRESSURE->getField()->shouldMultiThread(), KnStorePressure, SIM_ScalarField*, PRESSURE, const UT_VectorF&, x);
 
-    void KnSubtractPressureGradientPartial(SIM_VectorField* FLOW, const SIM_ScalarField* PRESSURE, const int AXIS, const UT_JobInfo& info)
+    void KnSubtractPressureGradientPartial(SIM_VectorField* FLOW, const SIM_ScalarField* PRESSURE, const SIM_IndexField* MARKER, const int AXIS, const UT_JobInfo& info)
     {
         UT_VoxelArrayIteratorF vit;
         vit.setArray(FLOW->getField(AXIS)->fieldNC());
@@ -236,6 +282,12 @@ namespace HinaFlow::Internal::Poisson
             constexpr int DIR_0 = 0, DIR_1 = 1;
             const UT_Vector3I cell0 = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR_0);
             const UT_Vector3I cell1 = SIM::FieldUtils::faceToCellMap(face, AXIS, DIR_1);
+            if ((CHECK_CELL_VALID(MARKER->getField(), cell0) && CHECK_CELL_TYPE<CellType::Solid>(MARKER, cell0)) ||
+                (CHECK_CELL_VALID(MARKER->getField(), cell1) && CHECK_CELL_TYPE<CellType::Solid>(MARKER, cell1)))
+            {
+                vit.setValue(0); // static solid
+                continue;
+            }
             // This will clamp the bounds to fit within the voxel array, using the border type to resolve out of range values.
             const fpreal32 p0 = PRESSURE->getField()->field()->getValue(static_cast<int>(cell0.x()), static_cast<int>(cell0.y()), static_cast<int>(cell0.z()));
             // This will clamp the bounds to fit within the voxel array, using the border type to resolve out of range values.
@@ -246,7 +298,7 @@ namespace HinaFlow::Internal::Poisson
         }
     }
 
-    THREADED_METHOD3(, PRESSURE->getField()->shouldMultiThread(), KnSubtractPressureGradient, SIM_VectorField*, FLOW, const SIM_ScalarField*, PRESSURE, const int, AXIS);
+    THREADED_METHOD4(, PRESSURE->getField()->shouldMultiThread(), KnSubtractPressureGradient, SIM_VectorField*, FLOW, const SIM_ScalarField*, PRESSURE, const SIM_IndexField*, MARKER, const int, AXIS);
 }
 
 void HinaFlow::Poisson::SolveMultiThreaded(const Input& input, const Param& param, Result& result)
@@ -264,13 +316,15 @@ void HinaFlow::Poisson::SolveMultiThreaded(const Input& input, const Param& para
 
 
     // Build b (Store Divergence Optional)
+    for (const int AXIS : GET_AXIS_ITER(input.FLOW))
+        Internal::Poisson::KnZeroSolidFaces(input.FLOW, input.MARKER, AXIS);
     UT_VectorF b(0, size - 1);
     Internal::Poisson::KnBuildRhs(b, input.FLOW, input.MARKER, result.DIVERGENCE);
 
 
     // Solve System
     x = b;
-    AImpl.solveConjugateGradient(x, b, nullptr);
+    result.residual = AImpl.solveConjugateGradient(x, b, nullptr, 1e-5f, -1, &result.iterations);
 
 
     // Store Pressure
@@ -279,7 +333,7 @@ void HinaFlow::Poisson::SolveMultiThreaded(const Input& input, const Param& para
 
     // Subtract Pressure Gradient
     for (const int AXIS : GET_AXIS_ITER(input.FLOW))
-        Internal::Poisson::KnSubtractPressureGradient(result.FLOW, result.PRESSURE, AXIS);
+        Internal::Poisson::KnSubtractPressureGradient(result.FLOW, result.PRESSURE, input.MARKER, AXIS);
 }
 
 void HinaFlow::Poisson::SolveDifferential(const Input& input, const Param& param, Result& result) { Solve(input, param, result); }
@@ -37,6 +37,8 @@ namespace HinaFlow
             SIM_VectorField* FLOW = nullptr; // required
             SIM_ScalarField* PRESSURE = nullptr; // required
             SIM_ScalarField* DIVERGENCE = nullptr; // optional
+            int iterations = 0; // out, CG iterations of the solve
+            float residual = 0; // out, relative CG residual of the solve
         };
 
         static void Solve(const Input& input, const Param& param, Result& result);
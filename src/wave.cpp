@@ -105,7 +105,43 @@ void HinaFlow::Wave::Solve(const Input& input, const Param& param, Result& resul
 
 namespace HinaFlow::Internal::Wave
 {
-    void KnBuildLaplaceMatrixPartial(UT_SparseMatrixF& A, const SIM_IndexField* MARKER, float factor, const UT_JobInfo& info)
+    using DampingProfiles = std::array<std::vector<float>, 3>;
+
+    /**
+    * Graded absorbing layer, damping the wave equation as u_tt + 2 * sigma * u_t = wave * L(u).
+    * At e cells from a wall, sigma = sigma_max * ((L - e) / L)^2 with sigma_max = strength * sqrt(wave) / (L * h).
+    * One profile per axis, summed at each cell and premultiplied by tau. All empty when the layer is disabled.
+    */
+    static DampingProfiles BuildDampingProfiles(const UT_Vector3I& res, const HinaFlow::Wave::Param& param, const float h, const float tau)
+    {
+        DampingProfiles profiles;
+        if (param.absorbing_layer <= 0)
+            return profiles;
+
+        const auto L = static_cast<float>(param.absorbing_layer);
+        const float sigma_max = param.absorbing_strength * std::sqrt(param.wave) / (L * h);
+        for (int AXIS : {0, 1, 2})
+        {
+            const exint n = res[AXIS];
+            profiles[AXIS].assign(n, 0.f);
+            if (n <= 1)
+                continue;
+            for (exint i = 0; i < n; ++i)
+            {
+                const auto e = static_cast<float>(std::min(i, n - 1 - i));
+                if (e < L)
+                    profiles[AXIS][i] = sigma_max * tau * ((L - e) / L) * ((L - e) / L);
+            }
+        }
+        return profiles;
+    }
+
+    inline float DAMPING_AT(const DampingProfiles& damping, const UT_Vector3I& cell)
+    {
+        return damping[0].empty() ? 0.f : damping[0][cell.x()] + damping[1][cell.y()] + damping[2][cell.z()];
+    }
+
+    void KnBuildLaplaceMatrixPartial(UT_SparseMatrixF& A, const SIM_IndexField* MARKER, float factor, const DampingProfiles& damping, const UT_JobInfo& info)
     {
         UT_VoxelArrayIteratorI vit;
         vit.setConstArray(MARKER->getField()->field());
@@ -121,7 +157,7 @@ namespace HinaFlow::Internal::Wave
             if (!CHECK_CELL_TYPE<CellType::Fluid>(MARKER, cell))
                 continue;
 
-            A.addToElement(idx, idx, 1.0f);
+            A.addToElement(idx, idx, 1.0f + DAMPING_AT(damping, cell));
 
             for (const int AXIS : GET_AXIS_ITER(MARKER->getField()))
             {
@@ -140,10 +176,40 @@ namespace HinaFlow::Internal::Wave
         }
     }
 
-    THREADED_METHOD3(, false /* DO NOT USE MULTI THREAD HERE */, KnBuildLaplaceMatrix, UT_SparseMatrixF&, A, const SIM_IndexField*, MARKER, float, factor);
+    THREADED_METHOD4(, false /* DO NOT USE MULTI THREAD HERE */, KnBuildLaplaceMatrix, UT_SparseMatrixF&, A, const SIM_IndexField*, MARKER, float, factor, const DampingProfiles&, damping);
 
 
-    void KnBuildRhsPartial(UT_VectorF& b, const SIM_RawField* FIELD, const SIM_RawField* FIELDS_PREV, const SIM_IndexField* MARKER, const UT_JobInfo& info)
+    void KnBuildInverseDiagonalPartial(UT_VectorF& inv_diagonal, const SIM_IndexField* MARKER, float factor, const DampingProfiles& damping, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorI vit;
+        vit.setConstArray(MARKER->getField()->field());
+        vit.setPartialRange(info.job(), info.numJobs());
+
+        const UT_Vector3I res = MARKER->getField()->getVoxelRes();
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+        {
+            const UT_Vector3I cell(vit.x(), vit.y(), vit.z());
+            const auto idx = TO_1D_IDX(cell, res);
+            if (!CHECK_CELL_TYPE<CellType::Fluid>(MARKER, cell))
+            {
+                inv_diagonal(idx) = 0;
+                continue;
+            }
+
+            float diagonal = 1.0f + DAMPING_AT(damping, cell);
+            for (const int AXIS : GET_AXIS_ITER(MARKER->getField()))
+                for (const int DIR : {0, 1})
+                    if (CHECK_CELL_VALID(MARKER->getField(), SIM::FieldUtils::cellToCellMap(cell, AXIS, DIR)))
+                        diagonal += factor;
+            inv_diagonal(idx) = 1.0f / diagonal;
+        }
+    }
+
+    THREADED_METHOD4(, MARKER->getField()->shouldMultiThread(), KnBuildInverseDiagonal, UT_VectorF&, inv_diagonal, const SIM_IndexField*, MARKER, float, factor, const DampingProfiles&, damping);
+
+
+    void KnBuildRhsPartial(UT_VectorF& b, const SIM_RawField* FIELD, const SIM_RawField* FIELDS_PREV, const SIM_IndexField* MARKER, const DampingProfiles& damping, const UT_JobInfo& info)
     {
         UT_VoxelArrayIteratorF vit;
         vit.setConstArray(FIELD->field());
@@ -162,13 +228,13 @@ namespace HinaFlow::Internal::Wave
             {
                 const fpreal32 un = vit.getValue();
                 const fpreal32 un_1 = SIM::FieldUtils::getFieldValue(*FIELDS_PREV, cell);
-                rhs = 2 * un - un_1;
+                rhs = 2 * un - (1 - DAMPING_AT(damping, cell)) * un_1;
             }
             b(idx) = rhs;
         }
     }
 
-    THREADED_METHOD4(, MARKER->getField()->shouldMultiThread(), KnBuildRhs, UT_VectorF&, b, const SIM_RawField*, FIELD, const SIM_RawField*, FIELDS_PREV, const SIM_IndexField*, MARKER);
+    THREADED_METHOD5(, MARKER->getField()->shouldMultiThread(), KnBuildRhs, UT_VectorF&, b, const SIM_RawField*, FIELD, const SIM_RawField*, FIELDS_PREV, const SIM_IndexField*, MARKER, const DampingProfiles&, damping);
 
 
     void KnStoreWavePartial(SIM_RawField* FIELD, const UT_VectorF& x, const UT_JobInfo& info)
@@ -189,6 +255,68 @@ namespace HinaFlow::Internal::Wave
     }
 
     THREADED_METHOD2(, FIELD->shouldMultiThread(), KnStoreWave, SIM_RawField*, FIELD, const UT_VectorF&, x);
+
+
+    void KnGatherFieldPartial(std::vector<float>& x, std::vector<unsigned char>& mask, const SIM_RawField* FIELD, const SIM_IndexField* MARKER, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorF vit;
+        vit.setConstArray(FIELD->field());
+        vit.setPartialRange(info.job(), info.numJobs());
+
+        const UT_Vector3I res = FIELD->getVoxelRes();
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+        {
+            const UT_Vector3I cell(vit.x(), vit.y(), vit.z());
+            const auto idx = TO_1D_IDX(cell, res);
+            mask[idx] = CHECK_CELL_TYPE<CellType::Fluid>(MARKER, cell);
+            x[idx] = mask[idx] ? vit.getValue() : 0;
+        }
+    }
+
+    THREADED_METHOD4(, FIELD->shouldMultiThread(), KnGatherField, std::vector<float>&, x, std::vector<unsigned char>&, mask, const SIM_RawField*, FIELD, const SIM_IndexField*, MARKER);
+
+
+    void KnScatterFieldPartial(SIM_RawField* FIELD, const std::vector<float>& x, const UT_JobInfo& info)
+    {
+        UT_VoxelArrayIteratorF vit;
+        vit.setArray(FIELD->fieldNC());
+        vit.setCompressOnExit(true);
+        vit.setPartialRange(info.job(), info.numJobs());
+
+        const UT_Vector3I res = FIELD->getVoxelRes();
+
+        for (vit.rewind(); !vit.atEnd(); vit.advance())
+        {
+            const UT_Vector3I cell(vit.x(), vit.y(), vit.z());
+            vit.setValue(x[TO_1D_IDX(cell, res)]);
+        }
+    }
+
+    THREADED_METHOD2(, FIELD->shouldMultiThread(), KnScatterField, SIM_RawField*, FIELD, const std::vector<float>&, x);
+
+
+    /**
+    * Gathers the current state into the history. A fresh history (or a resolution change)
+    * starts at rest, with the previous state equal to the current one.
+    */
+    static void LoadHistory(HinaFlow::Wave::History& HISTORY, std::vector<unsigned char>& mask, const SIM_RawField* FIELD, const SIM_IndexField* MARKER, const float dt)
+    {
+        const UT_Vector3I res = FIELD->getVoxelRes();
+        const exint size = FIELD->field()->numVoxels();
+
+        auto& u = HISTORY.buffers[HISTORY.current];
+        u.resize(size);
+        mask.resize(size);
+        KnGatherField(u, mask, FIELD, MARKER);
+
+        if (HISTORY.res != res || HISTORY.tau <= 0)
+        {
+            HISTORY.buffers[1 - HISTORY.current] = u;
+            HISTORY.tau = dt;
+            HISTORY.res = res;
+        }
+    }
 }
 
 void HinaFlow::Wave::SolveMultiThreaded(const Input& input, const Param& param, Result& result)
@@ -197,24 +325,227 @@ void HinaFlow::Wave::SolveMultiThreaded(const Input& input, const Param& param,
     const float h = input.MARKER->getVoxelSize().maxComponent();
 
 
-    // Build A
-    UT_SparseMatrixF A(size, size);
-    Internal::Wave::KnBuildLaplaceMatrix(A, input.MARKER, param.wave * (input.dt * input.dt) / (h * h));
-    UT_SparseMatrixRowF AImpl;
-    AImpl.buildFrom(A);
+    const float factor = param.wave * (input.dt * input.dt) / (h * h);
+    const Internal::Wave::DampingProfiles damping = Internal::Wave::BuildDampingProfiles(input.MARKER->getField()->getVoxelRes(), param, h, input.dt);
+
+
+    // Build A (or reuse the cached one)
+    OperatorCache local;
+    OperatorCache& cache = input.CACHE ? *input.CACHE : local;
+    std::uint64_t key = 0;
+    if (input.CACHE)
+    {
+        for (const float value : {param.wave, input.dt, h, static_cast<float>(param.absorbing_layer), param.absorbing_strength})
+            key = HASH_COMBINE(key, value);
+        key = HASH_COMBINE(key, HASH_FIELD(input.MARKER->getField()));
+    }
+    if (!cache.valid || cache.key != key)
+    {
+        UT_SparseMatrixF A(size, size);
+        Internal::Wave::KnBuildLaplaceMatrix(A, input.MARKER, factor, damping);
+        A.compile();
+        cache.A.buildFrom(A);
+        cache.inv_diagonal.init(0, size - 1);
+        Internal::Wave::KnBuildInverseDiagonal(cache.inv_diagonal, input.MARKER, factor, damping);
+        cache.key = key;
+        cache.valid = true;
+    }
     UT_VectorF x(0, size - 1);
     UT_VectorF b(0, size - 1);
 
 
     // Build b
-    Internal::Wave::KnBuildRhs(b, input.FIELDS->getField(), input.FIELDS_PREV->getField(), input.MARKER);
+    if (input.HISTORY)
+    {
+        std::vector<unsigned char> mask;
+        auto& HISTORY = *input.HISTORY;
+        Internal::Wave::LoadHistory(HISTORY, mask, input.FIELDS->getField(), input.MARKER, input.dt);
+
+        // Previous state taken back to one dt before the current one, assuming constant velocity
+        const auto& u = HISTORY.buffers[HISTORY.current];
+        const auto& u_prev = HISTORY.buffers[1 - HISTORY.current];
+        const float scale = input.dt / HISTORY.tau;
+        const UT_Vector3I res = input.MARKER->getField()->getVoxelRes();
+        UTparallelFor(UT_BlockedRange<exint>(0, size), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint i = r.begin(); i < r.end(); ++i)
+            {
+                const float un_1 = u[i] - (u[i] - u_prev[i]) * scale;
+                b(i) = mask[i] ? 2 * u[i] - (1 - Internal::Wave::DAMPING_AT(damping, TO_3D_IDX(i, res))) * un_1 : 0.f;
+            }
+        });
+    }
+    else
+        Internal::Wave::KnBuildRhs(b, input.FIELDS->getField(), input.FIELDS_PREV->getField(), input.MARKER, damping);
 
 
     // Solve System
     x = b;
-    AImpl.solveConjugateGradient(x, b, nullptr);
+    cache.A.solveConjugateGradient(x, b, param.preconditioner == SIM_RawField::PCG_METHOD::PCG_NONE ? nullptr : &cache.inv_diagonal);
 
 
     // Store Diffused Field
     Internal::Wave::KnStoreWave(result.FIELDS->getField(), x);
+
+    // The state just consumed becomes the previous one
+    if (input.HISTORY)
+    {
+        input.HISTORY->current = 1 - input.HISTORY->current;
+        input.HISTORY->tau = input.dt;
+    }
+}
+
+
+namespace HinaFlow::Internal::Wave
+{
+    /**
+    * One leapfrog step: U_PREV <- 2U - U_PREV + factor * L(U), in place.
+    * Missing neighbours (domain walls, 2D) read the cell itself, so the inner loop has no branch
+    * and the same code is the 7-point stencil in 3D and the 5-point stencil in 2D.
+    * With damping d = sigma * tau (centered): U_PREV <- (2U - (1 - d) U_PREV + factor * L(U)) / (1 + d),
+    * where the profiles are indexed from the global cell ORIGIN of the buffers.
+    */
+    static void StepLeapfrog(std::vector<float>& U_PREV, const std::vector<float>& U, const std::vector<unsigned char>& mask, const UT_Vector3I& res, const float factor, const DampingProfiles& damping, const UT_Vector3I& origin, const bool threaded = true)
+    {
+        const bool damped = !damping[0].empty();
+        const exint nx = res.x(), ny = res.y(), nz = res.z();
+        const exint sy = nx, sz = nx * ny;
+
+        auto body = [&](const UT_BlockedRange2D<exint>& r)
+        {
+            for (exint z = r.rows().begin(); z < r.rows().end(); ++z)
+            {
+                for (exint y = r.cols().begin(); y < r.cols().end(); ++y)
+                {
+                    const exint row = y * sy + z * sz;
+                    const float* u = &U[row];
+                    const float* uym = y > 0 ? u - sy : u;
+                    const float* uyp = y < ny - 1 ? u + sy : u;
+                    const float* uzm = z > 0 ? u - sz : u;
+                    const float* uzp = z < nz - 1 ? u + sz : u;
+                    const unsigned char* m = &mask[row];
+                    float* out = &U_PREV[row];
+
+                    if (!damped)
+                    {
+                        for (exint x = 0; x < nx; ++x)
+                        {
+                            const float c = u[x];
+                            const float uxm = x > 0 ? u[x - 1] : c;
+                            const float uxp = x < nx - 1 ? u[x + 1] : c;
+                            const float lap = uxm + uxp + uym[x] + uyp[x] + uzm[x] + uzp[x] - 6.f * c;
+                            out[x] = m[x] ? 2.f * c - out[x] + factor * lap : 0.f;
+                        }
+                        continue;
+                    }
+
+                    const float* dx = &damping[0][origin.x()];
+                    const float dyz = damping[1][origin.y() + y] + damping[2][origin.z() + z];
+                    for (exint x = 0; x < nx; ++x)
+                    {
+                        const float c = u[x];
+                        const float uxm = x > 0 ? u[x - 1] : c;
+                        const float uxp = x < nx - 1 ? u[x + 1] : c;
+                        const float lap = uxm + uxp + uym[x] + uyp[x] + uzm[x] + uzp[x] - 6.f * c;
+                        const float d = dx[x] + dyz;
+                        out[x] = m[x] ? (2.f * c - (1.f - d) * out[x] + factor * lap) / (1.f + d) : 0.f;
+                    }
+                }
+            }
+        };
+
+        if (threaded)
+            UTparallelFor(UT_BlockedRange2D<exint>(0, nz, 0, ny), body);
+        else
+            UTserialFor(UT_BlockedRange2D<exint>(0, nz, 0, ny), body);
+    }
+}
+
+/**
+* Explicit second order leapfrog, substepped to satisfy the CFL condition sqrt(wave) * dt / h <= cfl / sqrt(dim).
+* Only stencil sweeps over the fields, no matrix and no solve.
+*/
+void HinaFlow::Wave::SolveExplicit(const Input& input, const Param& param, Result& result)
+{
+    const UT_Vector3I res = input.MARKER->getField()->getVoxelRes();
+    const exint size = input.MARKER->getField()->field()->numVoxels();
+    const float h = input.MARKER->getVoxelSize().maxComponent();
+    const auto dim = static_cast<float>(GET_AXIS_ITER(input.MARKER->getField()).size());
+
+    const float courant = std::sqrt(param.wave) * input.dt / h;
+    const int substeps = std::max(1, static_cast<int>(std::ceil(courant * std::sqrt(dim) / param.cfl)));
+    const float tau = input.dt / static_cast<float>(substeps);
+    const float factor = param.wave * tau * tau / (h * h);
+
+    const Internal::Wave::DampingProfiles damping = Internal::Wave::BuildDampingProfiles(res, param, h, tau);
+
+    std::vector<unsigned char> mask(size);
+    std::vector<float> u_local, u_prev_local;
+    std::vector<float>* u = &u_local;
+    std::vector<float>* u_prev = &u_prev_local;
+    float tau_prev = input.dt;
+    if (input.HISTORY)
+    {
+        auto& HISTORY = *input.HISTORY;
+        Internal::Wave::LoadHistory(HISTORY, mask, input.FIELDS->getField(), input.MARKER, input.dt);
+        u = &HISTORY.buffers[HISTORY.current];
+        u_prev = &HISTORY.buffers[1 - HISTORY.current];
+        tau_prev = HISTORY.tau;
+    }
+    else
+    {
+        u_local.resize(size);
+        u_prev_local.resize(size);
+        Internal::Wave::KnGatherField(u_local, mask, input.FIELDS->getField(), input.MARKER);
+        Internal::Wave::KnGatherField(u_prev_local, mask, input.FIELDS_PREV->getField(), input.MARKER);
+    }
+
+    // Previous state one substep back, assuming constant velocity
+    if (tau != tau_prev)
+    {
+        const float scale = tau / tau_prev;
+        UTparallelFor(UT_BlockedRange<exint>(0, size), [&](const UT_BlockedRange<exint>& r)
+        {
+            for (exint i = r.begin(); i < r.end(); ++i)
+                (*u_prev)[i] = (*u)[i] - ((*u)[i] - (*u_prev)[i]) * scale;
+        });
+    }
+
+    if (param.temporal_block > 0)
+    {
+        // Each tile advances up to temporal_block substeps in cache, one halo cell per substep
+        std::vector<float> u_next(size), u_prev_next(size);
+        for (int done = 0; done < substeps;)
+        {
+            const int steps = std::min(param.temporal_block, substeps - done);
+            TEMPORAL_BLOCKING<2>({u, u_prev}, {&u_next, &u_prev_next}, mask, res, steps, [&](std::array<std::vector<float>, 2>& local, const std::vector<unsigned char>& local_mask, const UT_Vector3I& local_res, const UT_Vector3I& origin)
+            {
+                for (int _ = 0; _ < steps; ++_)
+                {
+                    Internal::Wave::StepLeapfrog(local[1], local[0], local_mask, local_res, factor, damping, origin, false);
+                    local[0].swap(local[1]);
+                }
+            });
+            u->swap(u_next);
+            u_prev->swap(u_prev_next);
+            done += steps;
+        }
+    }
+    else
+    {
+        for (int _ = 0; _ < substeps; ++_)
+        {
+            Internal::Wave::StepLeapfrog(*u_prev, *u, mask, res, factor, damping, UT_Vector3I(0, 0, 0));
+            std::swap(u, u_prev);
+        }
+    }
+
+    Internal::Wave::KnScatterField(result.FIELDS->getField(), *u);
+
+    // Keep the last substep pair, so the next frame continues without resampling
+    if (input.HISTORY)
+    {
+        input.HISTORY->current = u == &input.HISTORY->buffers[0] ? 0 : 1;
+        input.HISTORY->tau = tau;
+    }
 }
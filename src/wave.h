@@ -16,16 +16,48 @@
 #include <SIM/SIM_ScalarField.h>
 #include <SIM/SIM_VectorField.h>
 #include <SIM/SIM_IndexField.h>
+#include <UT/UT_SparseMatrix.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
 
 namespace HinaFlow
 {
     struct Wave
     {
+        /**
+        * Previous state kept by the solver between steps, owned by the caller (one per node and object).
+        * buffers[1 - current] holds the previous state, buffers[current] receives the current one.
+        * Buffers are swapped by index after each step, never copied.
+        */
+        struct History
+        {
+            std::array<std::vector<float>, 2> buffers;
+            int current = 0;
+            float tau = 0; // time between the previous and the current state
+            UT_Vector3I res{0, 0, 0}; // a resolution change restarts the history at rest
+        };
+
+        /**
+        * Assembled implicit system and its Jacobi preconditioner, owned by the caller (one per node and object).
+        * Reused by SolveMultiThreaded while wave, dt, voxel size, absorbing layer and marker content are unchanged.
+        */
+        struct OperatorCache
+        {
+            UT_SparseMatrixRowF A;
+            UT_VectorF inv_diagonal;
+            std::uint64_t key = 0;
+            bool valid = false;
+        };
+
         struct Input
         {
             SIM_ScalarField* FIELDS = nullptr; // required
-            SIM_ScalarField* FIELDS_PREV = nullptr; // required
+            SIM_ScalarField* FIELDS_PREV = nullptr; // required unless HISTORY is set, ignored otherwise
             SIM_IndexField* MARKER = nullptr; // required
+            History* HISTORY = nullptr; // optional, not supported by Solve (neither is the absorbing layer)
+            OperatorCache* CACHE = nullptr; // optional, only used by SolveMultiThreaded
             float dt = 1.f; // required
         };
 
@@ -33,6 +65,10 @@ namespace HinaFlow
         {
             SIM_RawField::PCG_METHOD preconditioner = SIM_RawField::PCG_METHOD::PCG_MIC;
             float wave = 0.01f;
+            float cfl = 0.9f; // explicit substep CFL number, must be <= 1
+            int temporal_block = 0; // explicit substeps advanced per cache tile, 0 sweeps the whole field per substep
+            int absorbing_layer = 0; // cells of absorbing layer along the domain walls, 0 keeps reflecting walls
+            float absorbing_strength = 10.f; // peak damping in units of wave speed / layer width
         };
 
         struct Result // Results
@@ -42,6 +78,7 @@ namespace HinaFlow
 
         static void Solve(const Input& input, const Param& param, Result& result);
         static void SolveMultiThreaded(const Input& input, const Param& param, Result& result);
+        static void SolveExplicit(const Input& input, const Param& param, Result& result);
     };
 }
 